@@ -7,21 +7,74 @@
 #include <ctype.h> //ASCII string conversion and checking.
 #include <errno.h> //Define errno macro for reporting error conditions
 #include <fcntl.h>
+#include <pthread.h> //worker threads for background search
+#include <stdatomic.h> //flags shared with the worker threads
 #include <stdio.h> //Standard I/O operation
 #include <stdlib.h>//dynamic memory management
 #include <stdarg.h> //
 #include <string.h>//used to mamipulate string array and memory blocks
 #include <sys/ioctl.h> //system call to manipulate terminal and special file
+#include <sys/mman.h> //mmap() to map a file straight into memory
+#include <sys/stat.h> //fstat() to get file size
 #include <sys/types.h> //provide system data type
+#include <sys/uio.h> //writev() to write many rows with one system call
+#include <limits.h> //IOV_MAX
+#include <poll.h> //wait for input and wakeups without spinning
+#include <signal.h> //SIGWINCH when the terminal is resized
 #include <termios.h> //provide std controlling, async communication port and terminal I/O
 #include <time.h> //
 #include <unistd.h>//not part of stdlib in C. Provide POSIX(Portable Operation System Interface) operation system API
+#ifdef __SSE2__
+#include <emmintrin.h> //SSE2 intrinsics for the search kernel
+#endif
+#ifdef __linux__
+#include <sys/inotify.h> //follow mode: be told when the file grow instead of polling it
+#define KILO_INOTIFY
+#endif
+#ifdef KILO_BENCH
+#include <regex.h> //regcomp(), what the regex engine is checked against
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h> //AVX2 kernels, only used when the CPU has it (checked at run time)
+#define KILO_AVX2
+#endif
 
 /*** defines ***/
 
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+//row buffers up to 2^(SLAB_MIN_SHIFT + SLAB_CLASSES - 1) bytes come from the slab, bigger ones from malloc
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 13
+#define SLAB_CHUNK_SIZE (256 * 1024)
+#define KILO_PREFETCH_ROWS 16 //rows above and below the screen that are rendered ahead of scrolling
+#define KILO_SEARCH_BLOCK 16384 //rows per unit of work for the search threads
+#define KILO_SEARCH_MAX_THREADS 8
+#define KILO_DFA_MAX_STATES 2048 //lazy DFA cache size, it is flushed and rebuilt when full
+#define KILO_ASYNC_SAVE_BYTES (4 * 1024 * 1024) //buffers this big are saved by a background thread
+#define KILO_INPUT_RING 4096 //bytes of terminal input buffered between reads, power of two
+#define KILO_INPUT_STAMPS 64 //arrival times kept for the reads still in the ring, power of two
+#define KILO_ESC_TIMEOUT_MS 100 //how long to wait for the rest of an escape sequence
+#define KILO_PASTE_TIMEOUT_MS 1000 //a paste that stall this long without its end marker is cut short
+#define KILO_MESSAGE_SECONDS 5 //status messages disappear after this long
+#define KILO_SAVE_TICK_MS 100 //redraw the save progress this often
+#ifndef KILO_UNDO_MAX_BYTES
+#define KILO_UNDO_MAX_BYTES (16 * 1024 * 1024) //memory kept for undo, oldest steps are dropped past it (override with -D)
+#endif
+#define KILO_HL_PROPAGATE_ROWS 256 //rows rehighlighted right away when an edit open or close a comment
+#define KILO_HL_SYNC_ROWS 8192 //rows the main thread highlight itself to catch up, past that it wait for the worker
+#define KILO_HL_SHORT_WORD 16 //chars of a word checked one by one before the vector kernel is called
+#define KILO_HL_BATCH_ROWS 4096 //rows the highlight worker do between checks of the screen
+#ifndef KILO_INDEX_MIN_BYTES
+#define KILO_INDEX_MIN_BYTES (64 * 1024 * 1024) //opening a file this big save its line index in the cache dir (override with -D)
+#endif
+#define KILO_INDEX_MAGIC "KILOIDX1"
+#define KILO_UNDO_COALESCE_MAX 1024 //keystrokes stop merging into one undo step past this many bytes
+#define KILO_FOLLOW_CHUNK (4 * 1024 * 1024) //bytes follow mode read per trip of the main loop, the rest wait for the next one
+#define KILO_FOLLOW_POLL_MS 1000 //without inotify the followed file is checked this often
+#define KILO_HIST_SUB_BITS 4 //latency histograms have 2^this buckets per power of two (about 6% apart)
+#define KILO_HIST_BUCKETS ((64 - KILO_HIST_SUB_BITS + 1) << KILO_HIST_SUB_BITS)
 //Set upper 3 bits of character(1 byte) to 0. mimic Ctrl press on terminal level
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -36,25 +89,375 @@ enum editorKey {
   HOME_KEY,
   END_KEY,
   PAGE_UP,
-  PAGE_DOWN
+  PAGE_DOWN,
+  KEY_WAKEUP, //not a key: background work made progress and the screen may need an update
+  KEY_PASTE //not a key: a bracketed paste arrived, the text is in E.paste
 };
 
 enum editorHighlight {
   HL_NORMAL = 0,
+  HL_COMMENT,
+  HL_MLCOMMENT,
+  HL_KEYWORD1,
+  HL_KEYWORD2,
+  HL_STRING,
   HL_NUMBER,
   HL_MATCH
 };
 
+#define HL_HIGHLIGHT_NUMBERS (1<<0)
+#define HL_HIGHLIGHT_STRINGS (1<<1)
+
+#define HL_STATE_UNKNOWN 0xff //hl_start of a row whose states must be recomputed
+
 /*** data ***/
 
+//create dynamic string
+struct abuf {
+  char *b;
+  int len;
+  int cap; //bytes allocated in b, always >= len
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+
 //erow stands for "editor row", it store line of text as pointer to dynamically re-allocate character abd data length
+//a tab in chars and the render column right after it
+struct tabStop {
+  int cx;
+  int rx;
+};
+
 typedef struct erow {
   int size;
   int rsize;
+  int cap; //bytes allocated for chars, 0 for mapped rows
+  int rcap; //bytes allocated for render and for hl
+  int flags; //ROW_* flags
   char *chars;
-  char *render;
+  char *render; //only valid when ROW_RENDERED is set
   unsigned char *hl;
+  struct tabStop *tabs; //every tab of the row in order, only valid when ROW_TABS is set
+  int ntabs;
+  int tabcap; //bytes allocated for tabs
+  unsigned char hl_start; //in a multi-line comment at the start of the row, HL_STATE_UNKNOWN if not computed
+  unsigned char hl_open; //in a multi-line comment at the end, valid for hl_start
 } erow;
+
+enum erowFlags {
+  ROW_MAPPED = 1, //chars point into the mmap of the file, not owned and not null terminated
+  ROW_RENDERED = 2, //render and hl match chars
+  ROW_SHARED = 4, //chars is also referenced by the running background save, copy before modifying
+  ROW_TABS = 8 //tabs index chars, kept up to date by the row operations once built
+};
+
+//rowStore is a gap buffer of rows. rows[0..gap) and rows[gap+gaplen..cap) hold the text,
+//the gap sits where the last insert/delete happened so the next edit close to it
+//only has to move the rows in between instead of the whole tail of the file
+struct rowStore {
+  erow *rows;
+  int cap; //number of slots allocated
+  int gap; //index of the first empty slot
+  int gaplen; //number of empty slots
+};
+
+//slab keep row buffers (chars, render, hl) in power of two size classes. freed blocks go
+//to a free list of their class and get reused, so typing doesn't call malloc()/free()
+//and the heap doesn't fragment. all chunks are released at once when the buffer closes
+struct slabChunk {
+  struct slabChunk *next;
+  char pad[8]; //keep the blocks after the header 16 bytes aligned
+};
+
+struct slab {
+  void *freelist[SLAB_CLASSES]; //one singly linked list of free blocks per size class
+  char *bump; //free space left at the end of the newest chunk
+  char *bumpend;
+  struct slabChunk *chunks; //every chunk, for the bulk free
+};
+
+//regex nfa state. SET consume one byte that is in set, SPLIT and EMPTY don't consume anything.
+//BOL and EOL don't consume anything either but only let through at the start / end of the row
+enum nfaType {
+  NFA_SET,
+  NFA_SPLIT,
+  NFA_EMPTY,
+  NFA_BOL,
+  NFA_EOL,
+  NFA_MATCH
+};
+
+struct nfaState {
+  int type;
+  int out, out1; //next states, out1 only for NFA_SPLIT
+  unsigned char set[32]; //bitmap of the 256 bytes accepted by NFA_SET
+};
+
+struct nfa {
+  struct nfaState *st;
+  int nst;
+  int cap;
+  int start;
+};
+
+//a compiled regex: the nfa, and the same nfa built from the reversed pattern to walk a match backward
+struct regex {
+  struct nfa fwd;
+  struct nfa rev;
+};
+
+//one DFA state: a set of nfa states, and the transition for every byte (-1 until it is needed)
+struct dfaState {
+  int *set;
+  int nset;
+  int match; //set contain NFA_MATCH
+  int endmatch[2]; //match if the text end here, through the NFA_EOL in set. [1] when it is also
+                   //the start of the text (an empty row). -1 until it is needed
+  int next[256];
+};
+
+//lazily built DFA. states are only created when the input reach them, so building cost
+//nothing for the bytes a pattern never see, and matching is one table lookup per byte
+struct dfa {
+  const struct nfa *nfa;
+  int unanchored; //a match can start anywhere, the start state is added at every step
+  struct dfaState **states;
+  int nstates;
+  int *hash; //open addressing table of state ids, sized 2 * KILO_DFA_MAX_STATES
+  int *stack; //scratch space for closures
+  unsigned char *mark;
+  int *buf;
+};
+
+//a compiled search query. skip is the Boyer-Moore-Horspool shift table used when SSE2 is not available
+struct searchPattern {
+  const char *s;
+  int len;
+  int skip[256];
+  struct regex *re; //compiled regex in regex mode, NULL for a literal query
+};
+
+//growable list of row numbers
+struct rowList {
+  int *rows;
+  int len;
+  int cap;
+};
+
+//one chunk of a search job, scanned by a single worker
+struct searchBlock {
+  struct rowList found; //matching rows of the block, in order
+  atomic_int done;
+};
+
+//a search split in blocks of KILO_SEARCH_BLOCK rows. workers take the next free block until
+//there is none left or the job is cancelled. the main thread merge finished blocks in order
+struct searchJob {
+  struct searchPattern pat;
+  char *query;
+  int *cand; //rows to check when the query only grew, NULL to scan every row
+  const char *map; //E.map and E.maplen when the job started. workers tell mapped rows by their
+  size_t maplen; //address, row->flags is written by the main thread while they run
+  int total; //number of rows (or candidates) to scan
+  int numrows; //E.numrows when the job started, rows streamed in after that were never looked at
+  int nblocks;
+  struct searchBlock *blocks;
+  atomic_int next; //next block nobody took yet
+  atomic_int cancel;
+  atomic_int found; //matches in finished blocks
+  atomic_int finished; //number of finished blocks
+  int running; //workers that may still touch the job, protected by the lock
+};
+
+//rows containing the current search query, in file order. kept while the prompt is open
+//so arrow keys jump straight to the next match and a longer query only rescan these rows
+struct findState {
+  char *query; //query the match list is built for, NULL if there is none
+  struct rowList matches; //matches merged so far
+  struct searchJob *job; //scan in progress, NULL when there is none
+  int merged; //blocks of job already copied into matches
+  int complete; //matches hold every row containing query
+  int current; //index in matches of the match on screen, -1 if none
+  int regex; //the prompt is a regex search (Ctrl-R)
+  struct regex *re; //compiled query in regex mode, NULL if it didn't compile
+  struct regexLocator *locator; //DFAs the main thread use to find the match inside a row
+
+  //thread pool, started by the first search
+  pthread_t *threads;
+  int nthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; //workers wait here for a new job
+  pthread_cond_t progress; //signaled when a block is done or a worker leave a job
+  unsigned jobgen; //incremented for every new job
+};
+
+//row chars as they were when a background save started
+struct saveRow {
+  char *chars;
+  int size;
+};
+
+//start of a line index file (see editorIndexLoad()), followed by one varint per row. the index
+//belong to the file with this size, mtime and inode, anything else mean the file changed
+struct lineIndexHeader {
+  char magic[8];
+  long long size;
+  long long mtime_sec;
+  long long mtime_nsec;
+  unsigned long long ino;
+  unsigned long long dev;
+  long long nrows;
+  long long datalen; //bytes of varints after the header
+};
+
+//a buffer that belonged to the save snapshot but was replaced in the row, freed when the save end
+struct saveOrphan {
+  void *p;
+  int cap;
+};
+
+//background save. the snapshot is only pointers: rows keep sharing their chars with it and
+//an edit copy the row first (ROW_SHARED), so editing can go on while the thread write the file
+struct saveJob {
+  char *filename; //the real file, symlinks resolved
+  char *tmp; //NULL when the file is written in place
+  int fd;
+  struct saveRow *rows;
+  int nrows;
+  long long total; //bytes to write
+  atomic_llong written;
+  atomic_int done;
+  int err; //errno of the failure, 0 on success
+  int dirty; //E.dirty when the snapshot was taken
+  double start;
+  pthread_t thread;
+  struct saveOrphan *orphans; //only touched by the main thread
+  int norphans;
+  int orphancap;
+};
+
+//terminal input read in bulk, keys are decoded from here. head and tail only grow,
+//index with & (KILO_INPUT_RING - 1)
+struct inputRing {
+  char buf[KILO_INPUT_RING];
+  unsigned head; //next byte to decode
+  unsigned tail; //next free byte
+  struct {
+    unsigned end; //the read() filled the ring up to here (excluded)
+    long long at; //and returned at that time
+  } stamps[KILO_INPUT_STAMPS]; //oldest first, a key is timed from the read() its first byte came with
+  unsigned shead, stail; //like head and tail, for stamps
+};
+
+//follow mode (kilo -f file), like tail -f: bytes appended to the file become new rows.
+//also used to stream a pipe (kilo -) into the buffer while the editor is already running
+struct followState {
+  int fd; //the file being followed or the pipe being read, -1 when neither
+  int inotify; //-1 if inotify isn't there, the file is then checked on a timer
+  int wd; //watch on the file
+  int dirwd; //watch on its directory, to see the new file of a rotation appear
+  off_t offset; //bytes of fd already in the buffer
+  ino_t ino; //the file fd is open on, a different one under the same name means it was rotated
+  dev_t dev;
+  int partial; //the last row didn't end with a newline yet, more bytes go on its end
+  unsigned partialedits; //E.edits after that row was read. if the rows changed since, the user may
+                         //have typed on it or deleted it, the next bytes start a new row
+  int stream; //fd is a pipe: nothing to watch, done at EOF
+  int armed; //the pipe was empty, poll() it. one shot, so a prompt (which doesn't read it) can't spin
+};
+
+enum undoType {
+  UNDO_INSERT,
+  UNDO_DELETE
+};
+
+//one undo step: text inserted at or deleted from (y, x). a '\n' in text is a row break
+struct undoRecord {
+  int type;
+  int eof; //insert made a new row at the end of the file, undo remove it
+  int y, x; //where the text start
+  int ey, ex; //where it end
+  int cy, cx; //cursor before the change
+  struct abuf text;
+};
+
+//records below pos can be undone, from pos to len redone. a new edit drop the redo part
+struct undoLog {
+  struct undoRecord *recs;
+  int len;
+  int cap;
+  int pos;
+  size_t bytes; //memory held by the records, kept under KILO_UNDO_MAX_BYTES
+  int open; //the last record can still take more keystrokes
+  int replaying; //undo/redo are editing, don't record
+};
+
+//what a row edit will change in render, taken before chars change (see editorRowEditBegin())
+struct rowEdit {
+  int at; //first char edited
+  int rx; //render column of at, the edit doesn't move it
+  int oldend; //render column where the old text stop affecting render
+};
+
+//filetype: how to highlight a kind of file
+struct editorSyntax {
+  char *filetype;
+  char **filematch; //extensions (.c) or parts of the file name
+  char **keywords; //a trailing | mark a type keyword
+  char *singleline_comment_start;
+  char *multiline_comment_start;
+  char *multiline_comment_end;
+  int flags; //HL_HIGHLIGHT_*
+};
+
+//highlighter state between two chars of a row
+struct hlState {
+  int in_comment; //inside a multi-line comment
+  int in_string; //quote that opened the string, 0 outside of one
+  int prev_sep; //the previous char was a separator, a number or keyword can start here
+  unsigned char prev_hl;
+};
+
+//background highlighting. the worker move E.hlvalid down the file while the main thread is
+//waiting for input. the main thread hold lock at every other moment, so the rows never change
+//under the worker and nothing else in the editor has to know about it
+struct hlWorker {
+  int enabled; //only the interactive editor use it, the bench highlight in the calling thread
+  int started;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; //signaled when the main thread go idle with rows left to highlight
+  atomic_int yield; //the main thread is waiting for lock, the worker stop at the next row
+};
+
+//where the time between a key arriving and its frame reaching the terminal goes
+enum latencyPhase {
+  LAT_DECODE, //from its first byte being read to the key being decoded
+  LAT_EDIT, //from there to the refresh (the key's work, prompts included)
+  LAT_SCROLL, //editorScroll()
+  LAT_DRAW, //building the frame and diffing it against the screen
+  LAT_WRITE, //write() to the terminal
+  LAT_TOTAL, //all of the above, key to paint
+  LAT_PHASES
+};
+
+//log-linear histogram of nanoseconds, like HdrHistogram: values below 2^(SUB_BITS+1) each get
+//a bucket, above that every power of two is split in 2^SUB_BITS buckets
+struct histogram {
+  long long counts[KILO_HIST_BUCKETS];
+  long long n;
+  long long sum;
+  long long max;
+};
+
+struct latencyStats {
+  struct histogram phase[LAT_PHASES];
+  long long input; //first byte of the key waiting for its frame, 0 when there is none
+  long long key; //when that key was decoded
+  long long last; //key to paint of the last key
+  int overlay; //show the numbers in the status bar (Ctrl-T)
+};
+
 //store editor state in E
 struct editorConfig {
   int cx, cy; //cursor position
@@ -64,21 +467,189 @@ struct editorConfig {
   int screenrows;
   int screencols;
   int numrows; //amount of rows
-  erow *row; //size of row in bytes
+  struct rowStore rows; //text buffer, index it with editorRowAt()
+  struct slab slab; //memory for the rows
   int dirty; //flag for non-empty text buffer
+  unsigned edits; //count every change to the rows, unlike dirty a save doesn't reset it
   char *filename;
+  char *map; //read-only mapping of the opened file, rows with ROW_MAPPED point into it
+  size_t maplen;
+  mode_t umask; //umask at startup, a new file get 0666 without it
   char statusmsg[80];
   time_t statusmsg_time;
+  struct abuf *screen; //what the terminal currently show, one buffer per screen line
+  struct abuf *backscreen; //the frame being drawn, swapped with screen once it is sent
+  int screenlines; //number of lines in screen and backscreen
+  int screenvalid; //0 force a full redraw
+  struct abuf frame; //escape sequences sent for one frame, reused every refresh
+  int framebytes; //bytes written to the terminal by the last editorRefreshScreen()
+  struct findState find;
+  struct saveJob *save; //background save in progress, NULL if none
+  struct undoLog undo;
+  struct editorSyntax *syntax; //NULL when no filetype match the file
+  int hlvalid; //rows below this have hl_start/hl_open chained from the top of the file
+  struct hlWorker hlworker;
+  struct inputRing input;
+  struct abuf paste; //text of the last bracketed paste
+  struct followState follow;
+  int wakefd[2]; //self-pipe: threads and signal handlers write a byte to wake up the main loop
+  atomic_int wakepending; //a byte is already in the pipe, don't write another one
+  atomic_int winch; //the terminal was resized
+  struct latencyStats lat;
+  int headless; //no terminal: frames go to capture and keys come from feed (the bench)
+  struct abuf capture; //output of a headless editor, the caller empty it
+  const char *feed; //keys not yet read by a headless editor
+  size_t feedlen;
   struct termios orig_termios; //original terminal state
 };
 
 struct editorConfig E;
 
+/*** filetypes ***/
+
+char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
+char *C_HL_keywords[] = {
+  "switch", "if", "while", "for", "break", "continue", "return", "else",
+  "struct", "union", "typedef", "static", "enum", "class", "case",
+
+  "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+  "void|", NULL
+};
+
+//highlight database
+struct editorSyntax HLDB[] = {
+  {
+    "c",
+    C_HL_extensions,
+    C_HL_keywords,
+    "//", "/*", "*/",
+    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+  },
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
 /*** prototypes ***/
 
 void editorSetStatusMessage(const char *fmt, ...);
+void editorWake(void);
+int getWindowSize(int *rows, int *cols);
+void editorSaveOrphan(void *p, int cap);
+void editorSaveWait(void);
+void editorFollowStop(void);
+void editorFollowRearm(void);
+void editorInvalidateScreen(void);
+erow *editorRowAt(int at);
+void editorUndoRecord(int type, int y, int x, const char *s, int len);
+void editorUndoClear(void);
 void editorRefreshScreen(void);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void abAppend(struct abuf *ab, const char *s, int len);
+void abReset(struct abuf *ab);
+void abFree(struct abuf *ab);
+void editorRowsRelease(void);
+void editorRowsAcquire(void);
+
+/*** latency ***/
+
+long long editorNanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int histBucket(long long v) {
+  if (v < (2 << KILO_HIST_SUB_BITS)) return v < 0 ? 0 : v;
+  int e = 63 - __builtin_clzll(v); //v is in [2^e, 2^(e+1))
+  return ((e - KILO_HIST_SUB_BITS) << KILO_HIST_SUB_BITS) + (v >> (e - KILO_HIST_SUB_BITS));
+}
+
+//smallest value that goes in bucket b
+long long histBucketLow(int b) {
+  if (b < (2 << KILO_HIST_SUB_BITS)) return b;
+  int e = (b >> KILO_HIST_SUB_BITS) + KILO_HIST_SUB_BITS - 1;
+  long long m = (b & ((1 << KILO_HIST_SUB_BITS) - 1)) + (1 << KILO_HIST_SUB_BITS);
+  return m << (e - KILO_HIST_SUB_BITS);
+}
+
+void histRecord(struct histogram *h, long long v) {
+  h->counts[histBucket(v)]++;
+  h->n++;
+  h->sum += v;
+  if (v > h->max) h->max = v;
+}
+
+//value at quantile q (0..1): the top of the bucket it falls in, never more than the max
+long long histQuantile(struct histogram *h, double q) {
+  if (h->n == 0) return 0;
+  long long want = (long long)(q * h->n + 0.5), seen = 0;
+  if (want < 1) want = 1;
+  int b;
+  for (b = 0; b < KILO_HIST_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= want) break;
+  }
+  long long top = b + 1 < KILO_HIST_BUCKETS ? histBucketLow(b + 1) - 1 : h->max;
+  return top < h->max ? top : h->max;
+}
+
+//editorReadKey() decoded a key whose first byte was there at `input`
+void editorLatencyKey(long long input) {
+  long long now = editorNanos();
+  histRecord(&E.lat.phase[LAT_DECODE], now - input);
+  if (E.lat.input == 0) { //keys decoded before the next frame count from the first one
+    E.lat.input = input;
+    E.lat.key = now;
+  }
+}
+
+//phase of the refresh for the waiting key, from start to now. return now
+long long editorLatencyPhase(int phase, long long start) {
+  long long now = editorNanos();
+  if (E.lat.input) histRecord(&E.lat.phase[phase], now - start);
+  return now;
+}
+
+//the frame of the waiting key was written
+void editorLatencyPainted(void) {
+  if (E.lat.input == 0) return;
+  E.lat.last = editorNanos() - E.lat.input;
+  histRecord(&E.lat.phase[LAT_TOTAL], E.lat.last);
+  E.lat.input = 0;
+}
+
+int editorCacheDir(char *dir, size_t size, int create);
+
+//append every histogram to $KILO_LATENCY_FILE, or latency.log in the cache dir, at exit
+void editorLatencyDump(void) {
+  static const char *names[LAT_PHASES] = {"decode", "edit", "scroll", "draw", "write", "total"};
+  if (E.lat.phase[LAT_TOTAL].n == 0) return;
+  char path[PATH_MAX];
+  const char *env = getenv("KILO_LATENCY_FILE");
+  if (env && env[0]) snprintf(path, sizeof(path), "%s", env);
+  else if (editorCacheDir(path, sizeof(path) - 16, 1) == 0) strcat(path, "/latency.log");
+  else return;
+  FILE *fp = fopen(path, "a");
+  if (fp == NULL) return;
+
+  fprintf(fp, "# kilo latency pid %d at %ld file %s keys %lld\n", (int)getpid(), (long)time(NULL),
+    E.filename ? E.filename : "[No Name]", E.lat.phase[LAT_TOTAL].n);
+  fprintf(fp, "%-7s %8s %10s %10s %10s %10s %10s %10s\n", "phase", "count", "mean_us",
+    "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us");
+  int j, b;
+  for (j = 0; j < LAT_PHASES; j++) {
+    struct histogram *h = &E.lat.phase[j];
+    fprintf(fp, "%-7s %8lld %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[j], h->n,
+      h->n ? h->sum / 1e3 / h->n : 0.0, histQuantile(h, 0.5) / 1e3, histQuantile(h, 0.9) / 1e3,
+      histQuantile(h, 0.99) / 1e3, histQuantile(h, 0.999) / 1e3, h->max / 1e3);
+  }
+  //the raw buckets, to merge sessions or plot them
+  for (j = 0; j < LAT_PHASES; j++)
+    for (b = 0; b < KILO_HIST_BUCKETS; b++)
+      if (E.lat.phase[j].counts[b])
+        fprintf(fp, "bucket %s %lld %lld\n", names[j], histBucketLow(b), E.lat.phase[j].counts[b]);
+  fclose(fp);
+}
 
 /*** terminal ***/
 
@@ -94,6 +665,7 @@ void die(const char *s) {
 }
 
 void disableRawmode(void) {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8); //bracketed paste off
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) die("tcgetattr");
   die("tcsetattr");
 }
@@ -112,29 +684,260 @@ void enableRawMode(void) {
   //Disable echo and canonical mode via bitwise operation so we can read input byte by byte 
   //ISIG here also disable Ctrl-C and Ctrl-Z
   raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-  //VMIN is minimum number of byte before read() and VTIME is set maximum time to wait before read() set to 1 = 100 millisec
+  //VMIN and VTIME 0 make read() return right away with what is there, waiting is done by poll()
   raw.c_cc[VMIN] = 0;
-  raw.c_cc[VTIME] = 1;
+  raw.c_cc[VTIME] = 0;
   //TCSAFLUSH discard any unread input before applying the change to the terminal
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+  //bracketed paste: the terminal wrap pasted text in ESC[200~ ... ESC[201~ so it can be inserted in one go
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
-//return key-press
- int editorReadKey(void) {
-  int nread;
-  char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) { //while read(keyboard input in to buffer &c each by 1 byte) != 1
-    if (nread == -1 && errno != EAGAIN) die("read");
+//wake up the main loop from another thread or a signal handler. several wakeups before
+//the main loop run are merged into one byte, so the pipe never fill up
+void editorWake(void) {
+  if (atomic_exchange(&E.wakepending, 1)) return;
+  int saved_errno = errno; //may be called from a signal handler
+  write(E.wakefd[1], "w", 1);
+  errno = saved_errno;
+}
+
+void editorHandleWinch(int sig) {
+  (void)sig;
+  atomic_store(&E.winch, 1);
+  editorWake();
+}
+
+//create the self-pipe and install the SIGWINCH handler
+void editorInitEvents(void) {
+  if (pipe(E.wakefd) == -1) die("pipe");
+  int j;
+  for (j = 0; j < 2; j++) {
+    fcntl(E.wakefd[j], F_SETFL, fcntl(E.wakefd[j], F_GETFL) | O_NONBLOCK);
+    fcntl(E.wakefd[j], F_SETFD, FD_CLOEXEC);
+  }
+  atomic_init(&E.wakepending, 0);
+  atomic_init(&E.winch, 0);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = editorHandleWinch;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+//pick up the new terminal size after a SIGWINCH
+void editorUpdateWindowSize(void) {
+  if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+  E.screenrows -= 2; //status bar and message bar
+  if (E.screenrows < 1) E.screenrows = 1;
+  editorInvalidateScreen();
+}
+
+//milliseconds until the main loop has something to redraw on its own, -1 for never.
+//an idle editor with no status message sleep in poll() until a key or a wakeup arrive
+int editorNextTimeout(void) {
+  int timeout = -1;
+  if (E.statusmsg[0] != '\0') {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long ms = (long long)(E.statusmsg_time + KILO_MESSAGE_SECONDS) * 1000 -
+                   ((long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    if (ms > 0) timeout = (int)ms;
+  }
+  //the save thread only wake us when it is done, progress is shown on a tick
+  if (E.save != NULL && (timeout < 0 || timeout > KILO_SAVE_TICK_MS)) timeout = KILO_SAVE_TICK_MS;
+  if (E.follow.fd != -1 && E.follow.inotify == -1 && (timeout < 0 || timeout > KILO_FOLLOW_POLL_MS))
+    timeout = KILO_FOLLOW_POLL_MS;
+  return timeout;
+}
+
+//the bytes up to the ring's tail arrived now
+void editorInputStamp(void) {
+  struct inputRing *in = &E.input;
+  if (in->stail - in->shead == KILO_INPUT_STAMPS) {
+    //no key decoded in that many reads: the last range grow, its new bytes are timed a bit early
+    in->stamps[(in->stail - 1) & (KILO_INPUT_STAMPS - 1)].end = in->tail;
+    return;
+  }
+  in->stamps[in->stail & (KILO_INPUT_STAMPS - 1)].end = in->tail;
+  in->stamps[in->stail & (KILO_INPUT_STAMPS - 1)].at = editorNanos();
+  in->stail++;
+}
+
+//when the byte at index at of the ring arrived. stamps of the bytes before it are dropped
+long long editorInputArrival(unsigned at) {
+  struct inputRing *in = &E.input;
+  while (in->shead != in->stail && (int)(in->stamps[in->shead & (KILO_INPUT_STAMPS - 1)].end - at) <= 0)
+    in->shead++;
+  if (in->shead == in->stail) return editorNanos(); //not from the ring
+  return in->stamps[in->shead & (KILO_INPUT_STAMPS - 1)].at;
+}
+
+//headless input: move what fits of E.feed into the ring. return 1 if anything was moved
+int editorFeedInput(void) {
+  struct inputRing *in = &E.input;
+  int got = 0;
+  while (E.feedlen > 0 && in->tail - in->head < KILO_INPUT_RING) {
+    unsigned off = in->tail & (KILO_INPUT_RING - 1);
+    size_t room = KILO_INPUT_RING - (in->tail - in->head);
+    if (room > KILO_INPUT_RING - off) room = KILO_INPUT_RING - off;
+    if (room > E.feedlen) room = E.feedlen;
+    memcpy(&in->buf[off], E.feed, room);
+    E.feed += room;
+    E.feedlen -= room;
+    in->tail += room;
+    got = 1;
+  }
+  if (got) editorInputStamp();
+  return got;
+}
+
+//wait up to timeout ms (-1 forever) for input or a wakeup. input is read into E.input with
+//as few read() calls as possible. return 1 if new input was read, 0 for a timeout or wakeup
+int editorPollInput(int timeout) {
+  if (E.headless) return editorFeedInput();
+  struct pollfd fds[4] = {
+    {.fd = STDIN_FILENO, .events = POLLIN},
+    {.fd = E.wakefd[0], .events = POLLIN},
+    {.fd = E.follow.inotify, .events = POLLIN}, //poll() skip it when it is -1
+    {.fd = E.follow.armed ? E.follow.fd : -1, .events = POLLIN},
+  };
+  editorRowsRelease(); //the highlight worker can run while we sleep
+  int ready = poll(fds, 4, timeout);
+  editorRowsAcquire();
+  if (ready == -1) {
+    if (errno == EINTR) return 0;
+    die("poll");
+  }
+
+  if (fds[1].revents & POLLIN) {
+    char drain[64];
+    atomic_store(&E.wakepending, 0);
+    while (read(E.wakefd[0], drain, sizeof(drain)) > 0);
+    if (atomic_exchange(&E.winch, 0)) editorUpdateWindowSize();
+  }
+  if (fds[2].revents & POLLIN) {
+    //what changed doesn't matter, editorFollowCheck() look at the file itself
+    char drain[4096] __attribute__((aligned(__alignof__(long))));
+    while (read(E.follow.inotify, drain, sizeof(drain)) > 0);
+  }
+  if (fds[3].revents & (POLLIN | POLLHUP)) E.follow.armed = 0; //the main loop read it next
+
+  int got = 0;
+  struct inputRing *in = &E.input;
+  //at most two read() when the free space wrap around the end of the ring
+  while ((fds[0].revents & (POLLIN | POLLHUP)) && in->tail - in->head < KILO_INPUT_RING) {
+    unsigned off = in->tail & (KILO_INPUT_RING - 1);
+    size_t room = KILO_INPUT_RING - (in->tail - in->head);
+    if (room > KILO_INPUT_RING - off) room = KILO_INPUT_RING - off;
+    ssize_t n = read(STDIN_FILENO, &in->buf[off], room);
+    if (n == -1 && errno != EAGAIN && errno != EINTR) die("read");
+    if (fds[0].revents & POLLHUP && n == 0) die("read"); //the terminal went away
+    if (n <= 0) break;
+    in->tail += n;
+    got = 1;
+    if ((size_t)n < room) break;
+  }
+  if (got) editorInputStamp();
+  return got;
+}
+
+//wait up to timeout ms for E.input to have at least one byte. return 0 if none came
+int editorInputWait(int timeout) {
+  struct inputRing *in = &E.input;
+  if (in->head != in->tail) return 1;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int left = timeout;
+  //wakeups don't count, keep waiting for the rest of the time
+  while (!editorPollInput(left)) {
+    if (E.headless) return 0; //nothing more is coming
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left = timeout - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+    if (left <= 0) return 0;
+  }
+  return 1;
+}
+
+//take one byte of input, waiting up to timeout ms for it to arrive. return 0 if none came
+int editorInputByte(int timeout, char *c) {
+  if (!editorInputWait(timeout)) return 0;
+  *c = E.input.buf[E.input.head++ & (KILO_INPUT_RING - 1)];
+  return 1;
+}
+
+//collect a bracketed paste into E.paste, up to the ESC[201~ that end it. text between escape
+//bytes is copied out of the ring in chunks instead of being decoded key by key
+int editorReadPaste(void) {
+  static const char end[] = "\x1b[201~";
+  struct inputRing *in = &E.input;
+  int matched = 0; //bytes of end seen so far
+  abReset(&E.paste);
+  while (matched < (int)sizeof(end) - 1) {
+    if (!editorInputWait(KILO_PASTE_TIMEOUT_MS)) break; //keep what we got
+    if (matched == 0) {
+      unsigned off = in->head & (KILO_INPUT_RING - 1);
+      size_t n = in->tail - in->head;
+      if (n > KILO_INPUT_RING - off) n = KILO_INPUT_RING - off;
+      char *esc = memchr(&in->buf[off], '\x1b', n);
+      size_t k = esc ? (size_t)(esc - &in->buf[off]) : n;
+      if (k > 0) {
+        abAppend(&E.paste, &in->buf[off], k);
+        in->head += k;
+        continue;
+      }
+    }
+    char c = in->buf[in->head++ & (KILO_INPUT_RING - 1)];
+    if (c == end[matched]) {
+      matched++;
+    } else {
+      abAppend(&E.paste, end, matched); //it was only text that look like the marker
+      matched = 0;
+      if (c == end[0]) matched = 1;
+      else abAppend(&E.paste, &c, 1);
+    }
+  }
+
+  //terminals send Enter as \r, turn \r and \r\n into \n
+  int j, k = 0;
+  for (j = 0; j < E.paste.len; j++) {
+    if (E.paste.b[j] == '\r') {
+      E.paste.b[k++] = '\n';
+      if (j + 1 < E.paste.len && E.paste.b[j + 1] == '\n') j++;
+    } else {
+      E.paste.b[k++] = E.paste.b[j];
+    }
   }
+  E.paste.len = k;
+  return KEY_PASTE;
+}
+
+//return key-press. block in poll() until input arrive, or return KEY_WAKEUP when a background
+//thread, a resize or a timer want the screen updated
+int editorDecodeKey(void) {
+  char c;
+  if (E.input.head == E.input.tail && !editorPollInput(editorNextTimeout())) return KEY_WAKEUP;
+  c = E.input.buf[E.input.head++ & (KILO_INPUT_RING - 1)];
 
   if (c == '\x1b') {
     char seq[3];
-    //Esc sequences key-press
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+    //Esc sequences key-press. the whole sequence usually came with the same read()
+    if (!editorInputByte(KILO_ESC_TIMEOUT_MS, &seq[0])) return '\x1b';
+    if (!editorInputByte(KILO_ESC_TIMEOUT_MS, &seq[1])) return '\x1b';
 
     if (seq[0] == '[') {
       if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+        if (!editorInputByte(KILO_ESC_TIMEOUT_MS, &seq[2])) return '\x1b';
+        if (seq[2] >= '0' && seq[2] <= '9') {
+          //longer number, only ESC[200~ (start of a bracketed paste) is used
+          int num = (seq[1] - '0') * 10 + (seq[2] - '0');
+          char d = 0; //stays 0 if the sequence is cut short
+          while (editorInputByte(KILO_ESC_TIMEOUT_MS, &d) && d >= '0' && d <= '9') num = num * 10 + (d - '0');
+          if (d == '~' && num == 200) return editorReadPaste();
+          return '\x1b';
+        }
         if (seq[2] == '~') {
           switch (seq[1]) {
             //due to HOME_KEY and END_KEY can have different ESC sequences depend on system so we handle of the case here
@@ -170,6 +973,15 @@ void enableRawMode(void) {
   }
 }
 
+//next key, with its decode time recorded from the read() that brought its first byte. keys of
+//a burst that waited in the ring count that wait too
+int editorReadKey(void) {
+  unsigned first = E.input.head; //already in the ring or not, the key start here
+  int c = editorDecodeKey();
+  if (c != KEY_WAKEUP) editorLatencyKey(editorInputArrival(first));
+  return c;
+}
+
 //Ancient Unix terminal magic!! this getCursorPosition and store in pointer (*rows and *cols)
 int getCursorPosition(int *rows, int *cols) {
   char buf[32];
@@ -178,7 +990,7 @@ int getCursorPosition(int *rows, int *cols) {
   if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
   //read 1 byte at time and store in buf. stop when detect R, buf is almost full or fail 
   while (i < sizeof(buf) -1) {
-    if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+    if (!editorInputByte(KILO_ESC_TIMEOUT_MS, &buf[i])) break;
     if (buf[i] == 'R') break;
     i++;
   }
@@ -209,351 +1021,3078 @@ int getWindowSize(int *rows, int *cols) {
 
 /*** syntax highlighting ***/
 
-int is_separator(int c) {
-  return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
-}
-
+//what each byte can do to the highlighter, looked up instead of calling isdigit() and strchr()
+enum charClassBits {
+  CC_SEP = 1, //separator, a number or keyword can start after it
+  CC_DIGIT = 2,
+  CC_NUMBER = 4, //continue a number: digits and .
+  CC_KEYWORD = 8, //first char of a keyword of the current filetype
+  CC_STATE = 16, //can open a string or a comment
+  CC_STOP = 32 //end a run of word chars: separators and CC_STATE
+};
 
-void editorUpdateSyntax(erow *row) {
-  row->hl = realloc(row->hl, row->rsize);
+unsigned char charClass[256];
+int (*hlSkipWordKernel)(const char *s, int i, int len); //fastest kernel this CPU can run
+int (*hlSkipWord)(const char *s, int i, int len); //the one usable with the current filetype
 
-  /*
-   * memset() - fill a block of memory with a specific constant byte value
-   * return a pointer to the memory area
-   * void *memset(void *s, int c, size_t n);
-   */
-  memset(row->hl, HL_NORMAL, row->rsize);
+int is_separator(int c) {
+  return charClass[(unsigned char)c] & CC_SEP;
+}
 
-  int prev_sep = 1;
+//first char at or after s[i] that end a word (CC_STOP), len if there is none
+int hlSkipWordScalar(const char *s, int i, int len) {
+  while (i < len && !(charClass[(unsigned char)s[i]] & CC_STOP)) i++;
+  return i;
+}
 
-  int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-    if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-       (c == '.' && prev_hl == HL_NUMBER)) {
-      row->hl[i] = HL_NUMBER;
-      i++;
-      prev_sep = 0;
-      continue;
-    }
+//the vector kernels stop on a fixed superset of CC_STOP that is cheap to test with compares:
+//control chars and space, "#$%&'()*+,-./, ;<=>, [, ] and ~. the table then decide
+static int hlStopMaybe(unsigned char c) {
+  return c <= ' ' || (c >= '"' && c <= '/') || (c >= ';' && c <= '>') ||
+         c == '[' || c == ']' || c == '~';
+}
 
-    prev_sep = is_separator(c);
-    i++;
+//settle the candidates in mask (bit n is s[i + n]), return the first real stop or -1
+static inline int hlStopFirst(const char *s, int i, unsigned mask) {
+  while (mask) {
+    int j = i + __builtin_ctz(mask);
+    if (charClass[(unsigned char)s[j]] & CC_STOP) return j;
+    mask &= mask - 1;
   }
+  return -1;
 }
 
-int editorSyntaxToColor(int hl) {
-  switch (hl) {
-    case HL_NUMBER: return 31;
-    case HL_MATCH: return 34;
-    default: return 37;
+#ifdef __SSE2__
+//16 chars at a time
+int hlSkipWordSSE2(const char *s, int i, int len) {
+  const __m128i sp = _mm_set1_epi8(' '), q = _mm_set1_epi8('"'), semi = _mm_set1_epi8(';');
+  const __m128i qn = _mm_set1_epi8('/' - '"'), semin = _mm_set1_epi8('>' - ';');
+  const __m128i lb = _mm_set1_epi8('['), rb = _mm_set1_epi8(']'), tilde = _mm_set1_epi8('~');
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i a = _mm_sub_epi8(v, q), b = _mm_sub_epi8(v, semi);
+    //unsigned x <= n is min(x, n) == x
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, sp), v),
+                _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(a, qn), a),
+                             _mm_cmpeq_epi8(_mm_min_epu8(b, semin), b)));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, lb),
+                        _mm_or_si128(_mm_cmpeq_epi8(v, rb), _mm_cmpeq_epi8(v, tilde))));
+    int j = hlStopFirst(s, i, _mm_movemask_epi8(m));
+    if (j >= 0) return j;
   }
+  return hlSkipWordScalar(s, i, len);
+}
+#endif
+
+//pick the kernel once, from what the CPU supports. there is no AVX2 word kernel: words long
+//enough for 32 chars at a time to beat 16 are rare, it measured no faster than SSE2 (make bench)
+void editorInitKernels(void) {
+  hlSkipWordKernel = hlSkipWordScalar;
+#ifdef __SSE2__
+  hlSkipWordKernel = hlSkipWordSSE2;
+#endif
 }
 
-/*** row operation ***/
+//name of the kernel in use, for the bench
+const char *editorKernelName(void) {
+#ifdef __SSE2__
+  if (hlSkipWord == hlSkipWordSSE2) return "sse2";
+#endif
+  return "scalar";
+}
 
-int editorRowCxtoRx(erow *row, int cx) {
-  int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP); //find how many column to the left of the next tab stop 
-    rx++;
+//rebuild charClass for the current filetype
+void editorSyntaxClasses(void) {
+  struct editorSyntax *syntax = E.syntax;
+  char *scs = syntax ? syntax->singleline_comment_start : NULL;
+  char *mcs = syntax ? syntax->multiline_comment_start : NULL;
+  int c, j;
+  for (c = 0; c < 256; c++) {
+    unsigned char cls = 0;
+    if (c == '\0' || (c < 128 && (isspace(c) || strchr(",.()+-/*=~%<>[];", c)))) cls |= CC_SEP;
+    if (c >= '0' && c <= '9') cls |= CC_DIGIT | CC_NUMBER;
+    if (c == '.') cls |= CC_NUMBER;
+    if (c == '"' || c == '\'') cls |= CC_STATE;
+    charClass[c] = cls;
+  }
+  if (scs && scs[0]) charClass[(unsigned char)scs[0]] |= CC_STATE;
+  if (mcs && mcs[0]) charClass[(unsigned char)mcs[0]] |= CC_STATE;
+  for (j = 0; syntax && syntax->keywords[j]; j++)
+    charClass[(unsigned char)syntax->keywords[j][0]] |= CC_KEYWORD;
+
+  //a filetype whose comments start with a word char would slip past the vector kernels
+  hlSkipWord = hlSkipWordKernel ? hlSkipWordKernel : hlSkipWordScalar;
+  for (c = 0; c < 256; c++) {
+    if (charClass[c] & (CC_SEP | CC_STATE)) charClass[c] |= CC_STOP;
+    if ((charClass[c] & CC_STOP) && !hlStopMaybe(c)) hlSkipWord = hlSkipWordScalar;
   }
-  return rx;
 }
 
-int editorRowRxToCx(erow *row, int rx) {
-  int cur_rx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-     cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-    cur_rx++;
+//does tok start at s[i]
+static inline int editorSyntaxAt(const char *s, int len, int i, const char *tok, int toklen) {
+  return toklen && i + toklen <= len && memcmp(&s[i], tok, toklen) == 0;
+}
 
-    if (cur_rx > rx) return cx;
-  }
-  return cx;
+static inline void editorSyntaxMark(unsigned char *hl, int i, int n, unsigned char h) {
+  if (hl) memset(&hl[i], h, n);
 }
 
-//free the old render buffer than allocate the new one, then copy each char to the render buffer
-void editorUpdateRow(erow *row) {
-  int tabs = 0;
-  int j;
-  for (j = 0; j < row->size; j++)
-    if (row->chars[j] == '\t') tabs++;
-  //because one character in chars[] can produce many characters in render (ex. \tA -> A) so we need J and idx serperately
-  free(row->render);
-  row->render = malloc(row->size + tabs*(KILO_TAB_STOP - 1) + 1); //maximum memory that need to render row. tabs is 8 char so here we simply multiply 7 by tabs + 1(row->size = 1)
-
-  //to display tabs/space correctly
-  int idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
+//chars [i, j) all come out as h without changing the scanner state. mark them, return 1 if
+//hl already had h somewhere past until: the scan is back in sync there and hl is marked up to it
+static inline int editorSyntaxRun(unsigned char *hl, int i, int j, int until, unsigned char h) {
+  if (hl == NULL) return 0;
+  int k = i > until ? i : until;
+  unsigned char *p = k < j ? memchr(&hl[k], h, j - k) : NULL;
+  if (p) j = p - hl;
+  memset(&hl[i], h, j - i);
+  return p != NULL;
+}
+
+//highlight s[i, len) starting from state *st, into hl (same indexes as s). hl is NULL when only
+//the end state is wanted. past column `until`, once a plain char or a number come out the same
+//as what hl already had the scanner is in the same state as before and the rest of hl is right:
+//stop and return 0. return 1 when the end of s is reached
+int editorSyntaxScan(const char *s, int len, unsigned char *hl, int i, int until, struct hlState *st) {
+  struct editorSyntax *syntax = E.syntax;
+  int flags = syntax ? syntax->flags : HL_HIGHLIGHT_NUMBERS; //no filetype: only numbers
+  char **keywords = syntax ? syntax->keywords : NULL;
+  char *scs = syntax ? syntax->singleline_comment_start : NULL;
+  char *mcs = syntax ? syntax->multiline_comment_start : NULL;
+  char *mce = syntax ? syntax->multiline_comment_end : NULL;
+  int scs_len = scs ? strlen(scs) : 0;
+  int mcs_len = mcs ? strlen(mcs) : 0;
+  int mce_len = mce ? strlen(mce) : 0;
+
+  while (i < len) {
+    if (hl == NULL) {
+      //only the end state is wanted, jump to the next char that can change it
+      if (st->in_comment) {
+        const char *p = mce_len ? memchr(&s[i], mce[0], len - i) : NULL;
+        if (p == NULL) return 1;
+        i = p - s;
+      } else if (!st->in_string) {
+        while (i < len && !(charClass[(unsigned char)s[i]] & CC_STATE)) i++;
+        if (i == len) return 1;
+      }
+    }
+    char c = s[i];
+    unsigned char cls = charClass[(unsigned char)c];
+
+    //single-line comment, the rest of the row
+    if (!st->in_string && !st->in_comment && (cls & CC_STATE) && editorSyntaxAt(s, len, i, scs, scs_len)) {
+      editorSyntaxMark(hl, i, len - i, HL_COMMENT);
+      st->prev_hl = HL_COMMENT;
+      return 1;
     }
-  }
-  //null terminate the string so C know where string end
-  row->render[idx] = '\0';
-  //Update the rsize
-  row->rsize = idx;
 
-  editorUpdateSyntax(row);
-}
+    if (mcs_len && mce_len && !st->in_string) {
+      if (st->in_comment) {
+        if (editorSyntaxAt(s, len, i, mce, mce_len)) {
+          editorSyntaxMark(hl, i, mce_len, HL_MLCOMMENT);
+          i += mce_len;
+          st->in_comment = 0;
+          st->prev_sep = 1;
+        } else {
+          editorSyntaxMark(hl, i, 1, HL_MLCOMMENT);
+          i++;
+        }
+        st->prev_hl = HL_MLCOMMENT;
+        continue;
+      } else if ((cls & CC_STATE) && editorSyntaxAt(s, len, i, mcs, mcs_len)) {
+        editorSyntaxMark(hl, i, mcs_len, HL_MLCOMMENT);
+        i += mcs_len;
+        st->in_comment = 1;
+        st->prev_hl = HL_MLCOMMENT;
+        continue;
+      }
+    }
 
-//to the new row
-void editorInsetRow(int at, char *s, size_t len) {
-  if (at < 0 || at > E.numrows) return;
+    if (flags & HL_HIGHLIGHT_STRINGS) {
+      if (st->in_string) {
+        editorSyntaxMark(hl, i, 1, HL_STRING);
+        st->prev_hl = HL_STRING;
+        st->prev_sep = 1;
+        //a backslash escape the next char, so \" doesn't close the string
+        if (c == '\\' && i + 1 < len) {
+          editorSyntaxMark(hl, i + 1, 1, HL_STRING);
+          i += 2;
+          continue;
+        }
+        if (c == st->in_string) st->in_string = 0;
+        i++;
+        continue;
+      } else if (c == '"' || c == '\'') {
+        st->in_string = c;
+        editorSyntaxMark(hl, i, 1, HL_STRING);
+        st->prev_hl = HL_STRING;
+        i++;
+        continue;
+      }
+    }
 
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+    //keywords only start after a separator and must be followed by one. a trailing | in the
+    //table mark the second kind of keyword (types). they don't matter for the end state
+    if (keywords && st->prev_sep && hl && (cls & CC_KEYWORD)) {
+      int j;
+      for (j = 0; keywords[j]; j++) {
+        if (keywords[j][0] != c) continue;
+        int klen = strlen(keywords[j]);
+        int kw2 = keywords[j][klen - 1] == '|';
+        if (kw2) klen--;
+        if (editorSyntaxAt(s, len, i, keywords[j], klen) &&
+            (i + klen == len || is_separator(s[i + klen]))) {
+          unsigned char h = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+          editorSyntaxMark(hl, i, klen, h);
+          i += klen;
+          st->prev_hl = h;
+          st->prev_sep = 0;
+          break;
+        }
+      }
+      if (keywords[j]) continue;
+    }
 
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+    unsigned char h = HL_NORMAL;
+    if ((flags & HL_HIGHLIGHT_NUMBERS) &&
+        (((cls & CC_DIGIT) && (st->prev_sep || st->prev_hl == HL_NUMBER)) ||
+         (c == '.' && st->prev_hl == HL_NUMBER))) {
+      h = HL_NUMBER;
+      st->prev_sep = 0;
+    } else {
+      st->prev_sep = (cls & CC_SEP) != 0;
+    }
+    if (hl) {
+      if (i >= until && hl[i] == h) return 0;
+      hl[i] = h;
+    }
+    st->prev_hl = h;
+    i++;
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].hl = NULL;
-  editorUpdateRow(&E.row[at]);
+    //the rest of a number, or of a word (where digits and keywords can't start), leave the
+    //state as it is: mark it in one go
+    int j = i;
+    if (h == HL_NUMBER) {
+      while (j < len && (charClass[(unsigned char)s[j]] & CC_NUMBER)) j++;
+    } else if (!st->prev_sep) {
+      //most words are a few chars, where the table is faster than setting up a vector.
+      //the kernel only take over the rest of a long one (hashes, base64, minified code)
+      int stop = len - j > KILO_HL_SHORT_WORD ? j + KILO_HL_SHORT_WORD : len;
+      while (j < stop && !(charClass[(unsigned char)s[j]] & CC_STOP)) j++;
+      if (j == stop && j < len) j = hlSkipWord(s, j, len);
+    }
+    if (editorSyntaxRun(hl, i, j, until, h)) return 0;
+    i = j;
+  }
+  return 1;
+}
 
-  E.numrows++;
-  E.dirty++;
+//rehighlight render from column `from` on. the scan restart right after a plain separator,
+//where no keyword, string or comment can be open, or at the start of the row. it back up far
+//enough that a comment delimiter ending at `from` is seen whole.
+//return 1 if the end of the row was reached and hl_open recomputed, 0 if it was back in sync before
+int editorUpdateSyntaxFrom(erow *row, int from, int until) {
+  struct hlState st = {0};
+  int p = from;
+  if (E.syntax) {
+    char *delims[] = {E.syntax->singleline_comment_start, E.syntax->multiline_comment_start,
+                      E.syntax->multiline_comment_end};
+    int j;
+    for (j = 0; j < 3; j++)
+      if (delims[j] && from - (int)strlen(delims[j]) + 1 < p) p = from - strlen(delims[j]) + 1;
+    if (p < 0) p = 0;
+  }
+  while (p > 0 && !(row->hl[p - 1] == HL_NORMAL && is_separator(row->render[p - 1]))) p--;
+  st.in_comment = p == 0 ? row->hl_start : 0;
+  st.prev_sep = 1;
+  st.prev_hl = HL_NORMAL;
+  if (!editorSyntaxScan(row->render, row->rsize, row->hl, p, until, &st)) return 0;
+  row->hl_open = st.in_comment;
+  return 1;
 }
 
-//free buffer
-void editorFreeRow(erow *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+//hl is allocated together with render in editorUpdateRow(), row->hl_start must be set
+void editorUpdateSyntax(erow *row) {
+  editorUpdateSyntaxFrom(row, 0, row->rsize);
 }
 
-void editorDelRow(int at) {
-  if (at < 0 || at >= E.numrows) return;
-  editorFreeRow(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1)); //slid array to the left by 1 to close the gap
-  E.numrows--;
-  E.dirty++;
+//end state of a row that isn't rendered, straight from chars (tabs don't change the result)
+void editorSyntaxRowState(erow *row) {
+  if (E.syntax == NULL || E.syntax->multiline_comment_start == NULL) {
+    row->hl_open = 0; //nothing can stay open at the end of a row
+    return;
+  }
+  struct hlState st = {row->hl_start, 0, 1, HL_NORMAL};
+  editorSyntaxScan(row->chars, row->size, NULL, 0, row->size, &st);
+  row->hl_open = st.in_comment;
 }
 
-void editorRowInsertChar(erow *row, int at, int c) {
-  if (at < 0 || at > row->size) at = row->size;
-  row->chars = realloc(row->chars, row->size + 2); //add 2 for the null byte(\0)
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
+//compute the end state of a row from its start state, and its hl too if it is rendered
+void editorSyntaxRow(erow *row, int start) {
+  row->hl_start = start;
+  if (row->flags & ROW_RENDERED) editorUpdateSyntax(row);
+  else editorSyntaxRowState(row);
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  E.dirty++;
+//start state of row at, the end state of the row before it. rows below E.hlvalid are known,
+//the frontier is moved forward up to at first
+int editorSyntaxStart(int at) {
+  while (E.hlvalid < at) {
+    int j = E.hlvalid;
+    int start = j == 0 ? 0 : editorRowAt(j - 1)->hl_open;
+    erow *row = editorRowAt(j);
+    if (row->hl_start != start) editorSyntaxRow(row, start);
+    E.hlvalid++;
+  }
+  return at == 0 ? 0 : editorRowAt(at - 1)->hl_open;
 }
 
-void editorRowDelChar(erow *row, int at) {
-  if (at < 0 || at >= row->size) return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->size--;
-  editorUpdateRow(row);
-  E.dirty++;
+//only a multi-line comment carry state from one row to the next
+int editorSyntaxMultiline(void) {
+  return E.syntax && E.syntax->multiline_comment_start && E.syntax->multiline_comment_end;
 }
 
-/*** editor operations ***/
+//rows far below the frontier are drawn plain and left to the worker, instead of stalling the
+//screen while every row above them is scanned
+int editorSyntaxDeferred(int at) {
+  return E.hlworker.enabled && at - E.hlvalid > KILO_HL_SYNC_ROWS && editorSyntaxMultiline();
+}
 
-void editorInsertChar(int c) {
+void *editorSyntaxWorker(void *arg) {
+  (void)arg;
+  struct hlWorker *w = &E.hlworker;
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    //the wait also hand the lock to a main thread that want the rows back, it signal
+    //again when it goes idle with rows left (editorRowsRelease())
+    if (atomic_load(&w->yield) || !editorSyntaxMultiline() || E.hlvalid >= E.numrows) {
+      pthread_cond_wait(&w->wake, &w->lock);
+      continue;
+    }
+    //the last row on screen stop being deferred once the frontier is this far
+    int need = E.rowoff + E.screenrows - KILO_HL_SYNC_ROWS;
+    int before = E.hlvalid;
+    int n = KILO_HL_BATCH_ROWS;
+    while (n-- > 0 && E.hlvalid < E.numrows && !atomic_load(&w->yield))
+      editorSyntaxStart(E.hlvalid + 1);
+    if (before < need && E.hlvalid >= need) editorWake(); //repaint the rows drawn plain
+  }
+  return NULL;
+}
+
+//the main thread is about to sleep: let the worker have the rows if there is work for it
+void editorRowsRelease(void) {
+  struct hlWorker *w = &E.hlworker;
+  if (!w->enabled) return;
+  if (editorSyntaxMultiline() && E.hlvalid < E.numrows) {
+    if (!w->started) {
+      if (pthread_create(&w->thread, NULL, editorSyntaxWorker, NULL) != 0) die("pthread_create");
+      w->started = 1;
+    }
+    pthread_cond_signal(&w->wake);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+//take the rows back, the worker let go of them after the row it is on
+void editorRowsAcquire(void) {
+  struct hlWorker *w = &E.hlworker;
+  if (!w->enabled) return;
+  atomic_store(&w->yield, 1);
+  pthread_mutex_lock(&w->lock);
+  atomic_store(&w->yield, 0);
+}
+
+//the interactive editor highlight in the background, from now on the main thread own the rows
+void editorSyntaxStartWorker(void) {
+  struct hlWorker *w = &E.hlworker;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+  atomic_init(&w->yield, 0);
+  w->started = 0;
+  pthread_mutex_lock(&w->lock);
+  w->enabled = 1;
+}
+
+//the start state of row at may have changed (the row before was edited, a row was inserted or
+//deleted). rows are fixed up while their start state differ from what they were highlighted with,
+//so typing /* only touch the rows it really comment out. past KILO_HL_PROPAGATE_ROWS rows
+//the frontier is pulled back instead and the rest is caught up when it is shown
+void editorSyntaxChanged(int at) {
+  int budget = KILO_HL_PROPAGATE_ROWS;
+  int j;
+  for (j = at; j < E.hlvalid; j++) {
+    int start = j == 0 ? 0 : editorRowAt(j - 1)->hl_open;
+    erow *row = editorRowAt(j);
+    if (row->hl_start == start) return; //back in sync
+    if (budget-- == 0) {
+      E.hlvalid = j;
+      return;
+    }
+    editorSyntaxRow(row, start);
+  }
+}
+
+//forget every row state, after the filetype changed
+void editorSyntaxReset(void) {
+  int j;
+  for (j = 0; j < E.numrows; j++) editorRowAt(j)->hl_start = HL_STATE_UNKNOWN;
+  E.hlvalid = 0;
+}
+
+int editorSyntaxToColor(int hl) {
+  switch (hl) {
+    case HL_COMMENT:
+    case HL_MLCOMMENT: return 36;
+    case HL_KEYWORD1: return 33;
+    case HL_KEYWORD2: return 32;
+    case HL_STRING: return 35;
+    case HL_NUMBER: return 31;
+    case HL_MATCH: return 34;
+    default: return 37;
+  }
+}
+
+//pick the filetype from the file name: an extension (starting with .) or any part of the name
+void editorSelectSyntaxHighlight(void) {
+  struct editorSyntax *old = E.syntax;
+  E.syntax = NULL;
+  if (E.filename != NULL) {
+    char *ext = strrchr(E.filename, '.');
+    unsigned int j;
+    for (j = 0; j < HLDB_ENTRIES && E.syntax == NULL; j++) {
+      struct editorSyntax *s = &HLDB[j];
+      int i;
+      for (i = 0; s->filematch[i]; i++) {
+        int is_ext = (s->filematch[i][0] == '.');
+        if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+            (!is_ext && strstr(E.filename, s->filematch[i]))) {
+          E.syntax = s;
+          break;
+        }
+      }
+    }
+  }
+  if (E.syntax != old) {
+    editorSyntaxClasses();
+    editorSyntaxReset();
+  }
+}
+
+/*** row memory ***/
+
+//size class of a block that can hold want bytes, or -1 if it is too big for the slab
+int slabClass(size_t want) {
+  int c = 0;
+  while (c < SLAB_CLASSES && ((size_t)1 << (c + SLAB_MIN_SHIFT)) < want) c++;
+  return c < SLAB_CLASSES ? c : -1;
+}
+
+//return a block of at least want bytes and store its real size in *cap
+void *slabAlloc(size_t want, int *cap) {
+  struct slab *sl = &E.slab;
+  int c = slabClass(want);
+  if (c == -1) {
+    //big line, leave some room so appending to it doesn't realloc every time
+    size_t big = want + want / 2;
+    void *p = malloc(big);
+    if (p == NULL) die("malloc");
+    *cap = big;
+    return p;
+  }
+
+  size_t size = (size_t)1 << (c + SLAB_MIN_SHIFT);
+  *cap = size;
+  if (sl->freelist[c]) {
+    void *p = sl->freelist[c];
+    sl->freelist[c] = *(void **)p; //the next pointer is stored inside the free block
+    return p;
+  }
+  if ((size_t)(sl->bumpend - sl->bump) < size) {
+    struct slabChunk *chunk = malloc(SLAB_CHUNK_SIZE);
+    if (chunk == NULL) die("malloc");
+    chunk->next = sl->chunks;
+    sl->chunks = chunk;
+    sl->bump = (char *)(chunk + 1);
+    sl->bumpend = (char *)chunk + SLAB_CHUNK_SIZE;
+  }
+  void *p = sl->bump;
+  sl->bump += size;
+  return p;
+}
+
+//give a block back to the free list of its class
+void slabFree(void *p, int cap) {
+  if (p == NULL) return;
+  int c = slabClass(cap);
+  if (c == -1) {
+    free(p);
+    return;
+  }
+  *(void **)p = E.slab.freelist[c];
+  E.slab.freelist[c] = p;
+}
+
+//make p hold at least want bytes, keeping the first keep bytes. does nothing if it is already big enough
+void *slabGrow(void *p, int *cap, size_t want, size_t keep) {
+  if (p && want <= (size_t)*cap) return p;
+  int newcap;
+  void *new = slabAlloc(want, &newcap);
+  if (p) {
+    memcpy(new, p, keep);
+    slabFree(p, *cap);
+  }
+  *cap = newcap;
+  return new;
+}
+
+//drop every chunk at once, all slab blocks become invalid
+void slabRelease(void) {
+  struct slab *sl = &E.slab;
+  while (sl->chunks) {
+    struct slabChunk *next = sl->chunks->next;
+    free(sl->chunks);
+    sl->chunks = next;
+  }
+  memset(sl, 0, sizeof(*sl));
+}
+
+/*** row store ***/
+
+//return row number at, skipping over the gap
+erow *editorRowAt(int at) {
+  struct rowStore *rs = &E.rows;
+  return &rs->rows[at < rs->gap ? at : at + rs->gaplen];
+}
+
+//index of a row from its address, the inverse of editorRowAt()
+int editorRowIndex(erow *row) {
+  struct rowStore *rs = &E.rows;
+  int i = row - rs->rows;
+  return i < rs->gap ? i : i - rs->gaplen;
+}
+
+//move the gap so it start at index at. only the rows between the old and the new gap position are moved
+void editorRowStoreMoveGap(int at) {
+  struct rowStore *rs = &E.rows;
+  if (at < rs->gap) {
+    memmove(&rs->rows[at + rs->gaplen], &rs->rows[at], sizeof(erow) * (rs->gap - at));
+  } else if (at > rs->gap) {
+    memmove(&rs->rows[rs->gap], &rs->rows[rs->gap + rs->gaplen], sizeof(erow) * (at - rs->gap));
+  }
+  rs->gap = at;
+}
+
+//open an empty slot at index at and return it, the caller fill in the row
+erow *editorRowStoreInsert(int at) {
+  struct rowStore *rs = &E.rows;
+  editorRowStoreMoveGap(at);
+  if (rs->gaplen == 0) {
+    //double the capacity so appending n rows cost O(n) in total, the tail goes to the end of new array
+    int newcap = rs->cap ? rs->cap * 2 : 16;
+    erow *new = realloc(rs->rows, sizeof(erow) * newcap);
+    if (new == NULL) die("realloc");
+    int tail = rs->cap - rs->gap;
+    memmove(&new[newcap - tail], &new[rs->gap], sizeof(erow) * tail);
+    rs->rows = new;
+    rs->gaplen = newcap - rs->cap;
+    rs->cap = newcap;
+  }
+  rs->gap++;
+  rs->gaplen--;
+  E.numrows++;
+  return &rs->rows[at];
+}
+
+//make room for n more rows at the end in one allocation, when the count is known up front
+void editorRowStoreReserve(int n) {
+  struct rowStore *rs = &E.rows;
+  if (rs->gaplen >= n) return;
+  editorRowStoreMoveGap(E.numrows);
+  int newcap = E.numrows + n;
+  erow *new = realloc(rs->rows, sizeof(erow) * newcap);
+  if (new == NULL) die("realloc");
+  rs->rows = new;
+  rs->gaplen = newcap - E.numrows;
+  rs->cap = newcap;
+}
+
+//remove row at from the store, the caller must free its buffers first
+void editorRowStoreDelete(int at) {
+  struct rowStore *rs = &E.rows;
+  editorRowStoreMoveGap(at);
+  rs->gaplen++; //row at was right after the gap, now it is part of it
+  E.numrows--;
+}
+
+/*** row operation ***/
+
+//tab index: cursor (cx) and render (rx) columns only differ because of tabs, so with the
+//position of every tab and the render column after it both conversions are a binary search.
+//rows without tabs never allocate anything
+
+//first tab at or after cx
+int editorTabFind(erow *row, int cx) {
+  int lo = 0, hi = row->ntabs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (row->tabs[mid].cx < cx) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+//render column of cx when tab k is the last tab before it
+static inline int editorTabRx(erow *row, int k, int cx) {
+  return k < 0 ? cx : row->tabs[k].rx + (cx - row->tabs[k].cx - 1);
+}
+
+//recompute rx of the tabs from `from`. past `keep` the tabs were only shifted, once one of them
+//land on the same column as before the rest did too and the loop stop
+void editorTabReflow(erow *row, int from, int keep) {
+  int k;
+  for (k = from; k < row->ntabs; k++) {
+    int rx = editorTabRx(row, k - 1, row->tabs[k].cx);
+    rx += KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+    if (k >= keep && rx == row->tabs[k].rx) break;
+    row->tabs[k].rx = rx;
+  }
+}
+
+//make room for n tabs at index k
+void editorTabMakeRoom(erow *row, int k, int n) {
+  size_t need = (row->ntabs + n) * sizeof(struct tabStop);
+  if (need > (size_t)row->tabcap)
+    row->tabs = slabGrow(row->tabs, &row->tabcap, need, row->ntabs * sizeof(struct tabStop));
+  memmove(&row->tabs[k + n], &row->tabs[k], (row->ntabs - k) * sizeof(struct tabStop));
+  row->ntabs += n;
+}
+
+//build the index with one memchr() pass over the row
+void editorRowIndexTabs(erow *row) {
+  if (row->flags & ROW_TABS) return;
+  row->ntabs = 0;
+  char *p = row->chars, *end = row->chars + row->size;
+  while ((p = memchr(p, '\t', end - p)) != NULL) {
+    editorTabMakeRoom(row, row->ntabs, 1);
+    row->tabs[row->ntabs - 1].cx = p - row->chars;
+    p++;
+  }
+  editorTabReflow(row, 0, row->ntabs);
+  row->flags |= ROW_TABS;
+}
+
+//len chars were inserted at `at`
+void editorTabsInsert(erow *row, int at, const char *s, int len) {
+  if (!(row->flags & ROW_TABS)) return;
+  int k = editorTabFind(row, at);
+  int j, n = 0;
+  for (j = k; j < row->ntabs; j++) row->tabs[j].cx += len;
+  for (j = 0; j < len; j++) if (s[j] == '\t') n++;
+  if (n) {
+    editorTabMakeRoom(row, k, n);
+    int i = k;
+    for (j = 0; j < len; j++) if (s[j] == '\t') row->tabs[i++].cx = at + j;
+  }
+  editorTabReflow(row, k, k + n);
+}
+
+//len chars were deleted from `at`
+void editorTabsDelete(erow *row, int at, int len) {
+  if (!(row->flags & ROW_TABS) || row->ntabs == 0) return;
+  int k = editorTabFind(row, at);
+  int e = editorTabFind(row, at + len);
+  memmove(&row->tabs[k], &row->tabs[e], (row->ntabs - e) * sizeof(struct tabStop));
+  row->ntabs -= e - k;
+  int j;
+  for (j = k; j < row->ntabs; j++) row->tabs[j].cx -= len;
+  editorTabReflow(row, k, k);
+}
+
+int editorRowCxtoRx(erow *row, int cx) {
+  editorRowIndexTabs(row);
+  return editorTabRx(row, editorTabFind(row, cx) - 1, cx);
+}
+
+//the char whose render columns contain rx, row->size past the end of the row
+int editorRowRxToCx(erow *row, int rx) {
+  editorRowIndexTabs(row);
+  //last tab ending at or before rx
+  int lo = 0, hi = row->ntabs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (row->tabs[mid].rx <= rx) lo = mid + 1;
+    else hi = mid;
+  }
+  int k = lo - 1;
+  int cx = k < 0 ? rx : row->tabs[k].cx + 1 + (rx - row->tabs[k].rx);
+  if (k + 1 < row->ntabs && row->tabs[k + 1].cx < cx) cx = row->tabs[k + 1].cx; //rx is inside the next tab
+  return cx < row->size ? cx : row->size;
+}
+
+//expand chars [from, to) into render starting at column idx, return the column after them.
+//the tab index must be up to date: the runs between tabs are copied whole
+int editorRenderChars(erow *row, int from, int to, int idx) {
+  int k = editorTabFind(row, from);
+  while (from < to) {
+    int end = k < row->ntabs && row->tabs[k].cx < to ? row->tabs[k].cx : to;
+    memcpy(&row->render[idx], &row->chars[from], end - from);
+    idx += end - from;
+    from = end;
+    if (from < to) {
+      //to display tabs/space correctly, pad to the next tab stop
+      int w = KILO_TAB_STOP - idx % KILO_TAB_STOP;
+      memset(&row->render[idx], ' ', w);
+      idx += w;
+      from++;
+      k++;
+    }
+  }
+  return idx;
+}
+
+void editorUpdateRow(erow *row) {
+  editorRowIndexTabs(row);
+  //because one character in chars[] can produce many characters in render (ex. \tA -> A) so we need J and idx serperately
+  //maximum memory that need to render row. tabs is 8 char so here we simply multiply 7 by tabs + 1(row->size = 1)
+  //the old buffers are reused when they are big enough, so most keystrokes don't allocate at all
+  size_t need = row->size + row->ntabs*(KILO_TAB_STOP - 1) + 1;
+  if (row->render == NULL || need > (size_t)row->rcap) {
+    slabFree(row->render, row->rcap);
+    slabFree(row->hl, row->rcap);
+    row->render = slabAlloc(need, &row->rcap);
+    int hlcap;
+    row->hl = slabAlloc(need, &hlcap); //same size class as render so rcap is valid for both
+  }
+
+  int idx = editorRenderChars(row, 0, row->size, 0);
+  //null terminate the string so C know where string end
+  row->render[idx] = '\0';
+  //Update the rsize
+  row->rsize = idx;
+
+  if (row->hl_start == HL_STATE_UNKNOWN) memset(row->hl, HL_NORMAL, row->rsize); //plain until the worker get there
+  else editorUpdateSyntax(row);
+  row->flags |= ROW_RENDERED;
+}
+
+//make sure render and hl exist, and hl match the state the row start in, before it is drawn or searched
+void editorRowPrepare(int at) {
+  erow *row = editorRowAt(at);
+  if (editorSyntaxDeferred(at)) {
+    //render it plain, or keep the colors it had. the worker wake us when it get close
+    if (!(row->flags & ROW_RENDERED)) {
+      row->hl_start = HL_STATE_UNKNOWN;
+      editorUpdateRow(row);
+    }
+    return;
+  }
+  int start = editorSyntaxStart(at);
+  if (!(row->flags & ROW_RENDERED)) {
+    row->hl_start = start;
+    editorUpdateRow(row);
+  } else if (row->hl_start != start) {
+    row->hl_start = start; //a comment was opened or closed above it
+    editorUpdateSyntax(row);
+  }
+}
+
+//an edit only change render from the edited char to the end of the first tab after the edit (its
+//width depend on where it start), after that the old render is just shifted. editorRowEditEnd()
+//move the tail, expand that short piece again and rehighlight until hl is back in sync.
+//rows that aren't rendered stay that way, they are rendered in full when they are drawn
+
+//render column where the chars from `from` stop affecting render, *cx is the char after
+int editorRowEditRegion(erow *row, int from, int *cx) {
+  int k = editorTabFind(row, from);
+  if (k < row->ntabs) {
+    if (cx) *cx = row->tabs[k].cx + 1;
+    return row->tabs[k].rx;
+  }
+  if (cx) *cx = row->size;
+  return editorTabRx(row, row->ntabs - 1, row->size);
+}
+
+//call before chars [at, at + dellen) are replaced
+void editorRowEditBegin(erow *row, struct rowEdit *ed, int at, int dellen) {
+  ed->at = at;
+  if (!(row->flags & ROW_RENDERED)) return;
+  editorRowIndexTabs(row);
+  ed->rx = editorRowCxtoRx(row, at);
+  ed->oldend = editorRowEditRegion(row, at + dellen, NULL);
+}
+
+//call once inslen chars are at ed->at and the tab index is updated
+void editorRowEditEnd(erow *row, struct rowEdit *ed, int inslen) {
+  if (!(row->flags & ROW_RENDERED)) {
+    //its end state is unknown now, recompute it and pass a change on to the next rows
+    row->hl_start = HL_STATE_UNKNOWN;
+    editorSyntaxChanged(editorRowIndex(row));
+    return;
+  }
+  int e;
+  int newend = editorRowEditRegion(row, ed->at + inslen, &e);
+  int rsize = row->rsize + (newend - ed->oldend);
+  if (rsize + 1 > row->rcap) {
+    int hlcap = row->rcap;
+    row->render = slabGrow(row->render, &row->rcap, rsize + 1, row->rsize + 1);
+    row->hl = slabGrow(row->hl, &hlcap, rsize + 1, row->rsize); //same size class as render
+  }
+  memmove(&row->render[newend], &row->render[ed->oldend], row->rsize - ed->oldend + 1);
+  memmove(&row->hl[newend], &row->hl[ed->oldend], row->rsize - ed->oldend);
+  row->rsize = rsize;
+  editorRenderChars(row, ed->at, e, ed->rx);
+  if (row->hl_start == HL_STATE_UNKNOWN) {
+    memset(&row->hl[ed->rx], HL_NORMAL, newend - ed->rx); //still drawn plain
+    return;
+  }
+  int open = row->hl_open;
+  if (editorUpdateSyntaxFrom(row, ed->rx, newend) && row->hl_open != open)
+    editorSyntaxChanged(editorRowIndex(row) + 1);
+}
+
+//to the new row
+void editorInsetRow(int at, char *s, size_t len) {
+  if (at < 0 || at > E.numrows) return;
+
+  erow *row = editorRowStoreInsert(at);
+
+  row->size = len;
+  row->flags = 0;
+  row->chars = slabAlloc(len + 1, &row->cap);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+
+  row->rsize = 0;
+  row->rcap = 0;
+  row->render = NULL;
+  row->hl = NULL;
+  row->tabs = NULL;
+  row->ntabs = 0;
+  row->tabcap = 0;
+  row->hl_start = HL_STATE_UNKNOWN;
+  row->hl_open = 0;
+  if (at < E.hlvalid) {
+    E.hlvalid++;
+    editorSyntaxChanged(at);
+  }
+
+  E.dirty++;
+  E.edits++;
+}
+
+//append a row that point straight into the file mapping. nothing is copied and
+//like every new row render/hl are left empty until editorRowPrepare() is called
+void editorAppendMappedRow(char *s, size_t len) {
+  erow *row = editorRowStoreInsert(E.numrows);
+  row->size = len;
+  row->flags = ROW_MAPPED;
+  row->chars = s;
+  row->cap = 0;
+  row->rsize = 0;
+  row->rcap = 0;
+  row->render = NULL;
+  row->hl = NULL;
+  row->tabs = NULL;
+  row->ntabs = 0;
+  row->tabcap = 0;
+  row->hl_start = HL_STATE_UNKNOWN;
+  row->hl_open = 0;
+}
+
+//copy a mapped row (or one a background save is still writing) into its own buffer,
+//must be called before chars is modified
+void editorRowOwn(erow *row) {
+  if (!(row->flags & (ROW_MAPPED | ROW_SHARED))) return;
+  int oldcap = row->cap;
+  char *chars = slabAlloc(row->size + 1, &row->cap);
+  memcpy(chars, row->chars, row->size);
+  chars[row->size] = '\0';
+  if (row->flags & ROW_SHARED) editorSaveOrphan(row->chars, oldcap); //the save still need the old one
+  row->chars = chars;
+  row->flags &= ~(ROW_MAPPED | ROW_SHARED);
+}
+
+//free buffer
+void editorFreeRow(erow *row) {
+  slabFree(row->render, row->rcap);
+  slabFree(row->hl, row->rcap);
+  slabFree(row->tabs, row->tabcap);
+  if (row->flags & ROW_SHARED) editorSaveOrphan(row->chars, row->cap);
+  else if (!(row->flags & ROW_MAPPED)) slabFree(row->chars, row->cap);
+}
+
+void editorDelRow(int at) {
+  if (at < 0 || at >= E.numrows) return;
+  editorFreeRow(editorRowAt(at));
+  editorRowStoreDelete(at);
+  if (at < E.hlvalid) {
+    E.hlvalid--;
+    editorSyntaxChanged(at); //the next row now start where the one before ended
+  }
+  E.dirty++;
+  E.edits++;
+}
+
+//throw away every row. only blocks too big for the slab are freed one by one,
+//everything else goes back to the system in one go with the slab chunks
+void editorFreeRows(void) {
+  editorSaveWait(); //the save thread may still read the rows
+  editorUndoClear();
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    if (slabClass(row->rcap) == -1) {
+      free(row->render);
+      free(row->hl);
+    }
+    if (slabClass(row->tabcap) == -1) free(row->tabs);
+    if (!(row->flags & ROW_MAPPED) && slabClass(row->cap) == -1) free(row->chars);
+  }
+  slabRelease();
+  free(E.rows.rows);
+  memset(&E.rows, 0, sizeof(E.rows));
+  E.numrows = 0;
+  E.hlvalid = 0;
+  if (E.map) {
+    munmap(E.map, E.maplen);
+    E.map = NULL;
+    E.maplen = 0;
+  }
+}
+
+void editorRowInsertChar(erow *row, int at, int c) {
+  if (at < 0 || at > row->size) at = row->size;
+  editorRowOwn(row);
+  //add 2 for the null byte(\0). the block is replaced by the next size class only when it is full
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, at, 0);
+  row->chars = slabGrow(row->chars, &row->cap, row->size + 2, row->size + 1);
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  char ch = c;
+  editorTabsInsert(row, at, &ch, 1);
+  editorRowEditEnd(row, &ed, 1);
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len) {
+  editorRowOwn(row);
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, row->size, 0);
+  row->chars = slabGrow(row->chars, &row->cap, row->size + len + 1, row->size + 1);
+  memcpy(&row->chars[row->size], s, len);
+  editorTabsInsert(row, row->size, s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  editorRowEditEnd(row, &ed, len);
+  E.dirty++;
+  E.edits++;
+}
+
+//replace every char of the row with s
+void editorRowSetChars(erow *row, const char *s, int len) {
+  editorRowOwn(row);
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, 0, row->size);
+  editorTabsDelete(row, 0, row->size);
+  row->chars = slabGrow(row->chars, &row->cap, len + 1, 0);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+  row->size = len;
+  editorTabsInsert(row, 0, s, len);
+  editorRowEditEnd(row, &ed, len);
+  E.dirty++;
+  E.edits++;
+}
+
+//cut the row at len, used when a line is split in two
+void editorRowTruncate(erow *row, int len) {
+  if (len < 0 || len > row->size) return;
+  editorRowOwn(row);
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, len, row->size - len);
+  editorTabsDelete(row, len, row->size - len);
+  row->size = len;
+  row->chars[len] = '\0';
+  editorRowEditEnd(row, &ed, 0);
+  E.dirty++;
+  E.edits++;
+}
+
+//remove len chars from at
+void editorRowDelChars(erow *row, int at, int len) {
+  if (at < 0 || len <= 0 || at + len > row->size) return;
+  editorRowOwn(row);
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, at, len);
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+  row->size -= len;
+  editorTabsDelete(row, at, len);
+  editorRowEditEnd(row, &ed, 0);
+  E.dirty++;
+  E.edits++;
+}
+
+void editorRowDelChar(erow *row, int at) {
+  if (at < 0 || at >= row->size) return;
+  editorRowOwn(row);
+  struct rowEdit ed;
+  editorRowEditBegin(row, &ed, at, 1);
+  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+  row->size--;
+  editorTabsDelete(row, at, 1);
+  editorRowEditEnd(row, &ed, 0);
+  E.dirty++;
+  E.edits++;
+}
+
+/*** editor operations ***/
+
+void editorInsertChar(int c) {
+  char ch = c;
+  editorUndoRecord(UNDO_INSERT, E.cy, E.cx, &ch, 1);
   if (E.cy == E.numrows) {
     editorInsetRow(E.numrows, "", 0);
   }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
-  E.cx++;
-  E.dirty++;
+  editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+  E.cx++;
+  E.dirty++;
+  E.edits++;
+}
+
+void editorDelChar(void) {
+  if (E.cy == E.numrows) return;
+  if (E.cx == 0 && E.cy == 0) return;
+
+  erow *row = editorRowAt(E.cy);
+  if (E.cx > 0) {
+    editorUndoRecord(UNDO_DELETE, E.cy, E.cx - 1, &row->chars[E.cx - 1], 1);
+    editorRowDelChar(row, E.cx - 1);
+    E.cx--;
+  } else {
+    erow *prev = editorRowAt(E.cy - 1);
+    editorUndoRecord(UNDO_DELETE, E.cy - 1, prev->size, "\n", 1);
+    E.cx = prev->size;
+    editorRowAppendString(prev, row->chars, row->size);
+    editorDelRow(E.cy);
+    E.cy--;
+  }
+}
+
+void editorInsertNewLine(void) {
+  //past the last row only an empty row is added, no row is split
+  editorUndoRecord(UNDO_INSERT, E.cy, E.cx, "\n", E.cy == E.numrows ? 0 : 1);
+  if (E.cx ==0) {
+    editorInsetRow(E.cy, "", 0);
+  } else {
+    erow *row = editorRowAt(E.cy);
+    editorInsetRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+    editorRowTruncate(editorRowAt(E.cy), E.cx); //row pointer can move when the store insert a row
+  }
+  E.cy++;
+  E.cx = 0;
+}
+
+
+
+//insert a block of text at the cursor (a paste, undo). the text is split at '\n' in one pass, new rows
+//go in with their final content and the tail of the cursor row is moved once, after the last line.
+//rows are only invalidated, so they are rendered once when they are drawn
+void editorInsertText(const char *s, size_t len) {
+  if (len == 0) return;
+  editorUndoRecord(UNDO_INSERT, E.cy, E.cx, s, len);
+  if (E.cy == E.numrows) editorInsetRow(E.numrows, "", 0);
+  erow *row = editorRowAt(E.cy);
+  int taillen = row->size - E.cx;
+  char *tail = malloc(taillen + 1);
+  if (tail == NULL) die("malloc");
+  memcpy(tail, &row->chars[E.cx], taillen);
+  editorRowTruncate(row, E.cx);
+
+  int y = E.cy;
+  size_t p = 0;
+  while (1) {
+    const char *nl = memchr(&s[p], '\n', len - p);
+    size_t e = nl ? (size_t)(nl - s) : len;
+    if (y == E.cy) editorRowAppendString(editorRowAt(y), (char *)&s[p], e - p);
+    else editorInsetRow(y, (char *)&s[p], e - p);
+    if (e == len) break;
+    p = e + 1;
+    y++;
+  }
+
+  row = editorRowAt(y);
+  E.cy = y;
+  E.cx = row->size;
+  editorRowAppendString(row, tail, taillen);
+  free(tail);
+}
+
+//delete len bytes starting at (y, x), every '\n' counted in len join a row with the next one (undo)
+void editorDeleteText(int y, int x, size_t len) {
+  while (len > 0 && y < E.numrows) {
+    erow *row = editorRowAt(y);
+    size_t avail = row->size - x;
+    if (len <= avail) {
+      editorRowDelChars(row, x, len);
+      break;
+    }
+    editorRowTruncate(row, x);
+    len -= avail + 1; //the rest of the row and its newline
+    if (y + 1 >= E.numrows) break;
+    erow *next = editorRowAt(y + 1);
+    editorRowAppendString(row, next->chars, next->size);
+    editorDelRow(y + 1);
+  }
+}
+
+/*** file I/O ***/
+
+//turn every rows in to one big text buffer
+char *editorRowToString(int *buflen) {
+  int totlen = 0;
+  int j;
+  for (j = 0; j < E.numrows; j++)
+    totlen += editorRowAt(j)->size + 1;
+  *buflen = totlen;
+
+  char *buf = malloc(totlen);
+  char *p = buf;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    memcpy(p, row->chars, row->size);
+    p += row->size;
+    *p = '\n';
+    p++;
+  }
+
+  return buf;
+}
+
+//line index: the rows of a big file stored as varints of (length << 2 | bytes of line ending),
+//so offsets are rebuilt by adding them up. it live in $XDG_CACHE_HOME/kilo (~/.cache/kilo) under
+//a hash of the file's real path and let a reopen create the rows without reading the file
+
+//$XDG_CACHE_HOME/kilo (~/.cache/kilo) into dir, created with create. -1 if there is none
+int editorCacheDir(char *dir, size_t size, int create) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && xdg[0]) snprintf(dir, size, "%s", xdg);
+  else if (home && home[0]) snprintf(dir, size, "%s/.cache", home);
+  else return -1;
+  if (create) mkdir(dir, 0700);
+  size_t len = strlen(dir);
+  snprintf(dir + len, size - len, "/kilo");
+  if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+  return 0;
+}
+
+//path of the index of filename, NULL if it has none. with create the directories are made
+char *editorIndexPath(const char *filename, int create) {
+  char *real = realpath(filename, NULL);
+  if (real == NULL) return NULL;
+  unsigned long long h = 1469598103934665603ULL; //FNV-1a
+  char *p;
+  for (p = real; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+  free(real);
+
+  char dir[PATH_MAX];
+  if (editorCacheDir(dir, sizeof(dir), create) == -1) return NULL;
+  size_t pathlen = strlen(dir) + 32;
+  char *path = malloc(pathlen);
+  snprintf(path, pathlen, "%s/%016llx.idx", dir, h);
+  return path;
+}
+
+void editorIndexHeader(struct lineIndexHeader *hdr, struct stat *st) {
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, KILO_INDEX_MAGIC, sizeof(hdr->magic));
+  hdr->size = st->st_size;
+  hdr->mtime_sec = st->st_mtim.tv_sec;
+  hdr->mtime_nsec = st->st_mtim.tv_nsec;
+  hdr->ino = st->st_ino;
+  hdr->dev = st->st_dev;
+}
+
+//read one varint from [*p, end), -1 if it is cut short
+static inline long long editorIndexVarint(const unsigned char **p, const unsigned char *end) {
+  unsigned long long v = 0;
+  int shift;
+  for (shift = 0; *p < end && shift < 64; shift += 7) {
+    unsigned char b = *(*p)++;
+    v |= (unsigned long long)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return (long long)v;
+  }
+  return -1;
+}
+
+//create the rows of the file mapped in E.map from its index. return -1, with no row created,
+//when there is no index or it doesn't match the file exactly
+int editorIndexLoad(const char *filename, struct stat *st) {
+  char *path = editorIndexPath(filename, 0);
+  if (path == NULL) return -1;
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd == -1) return -1;
+
+  struct lineIndexHeader hdr, want;
+  editorIndexHeader(&want, st);
+  unsigned char *data = NULL;
+  int ok = read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+           memcmp(hdr.magic, want.magic, sizeof(hdr.magic)) == 0 &&
+           hdr.size == want.size && hdr.mtime_sec == want.mtime_sec &&
+           hdr.mtime_nsec == want.mtime_nsec && hdr.ino == want.ino && hdr.dev == want.dev &&
+           hdr.nrows > 0 && hdr.nrows <= INT_MAX && hdr.datalen > 0 && hdr.datalen <= hdr.size * 2 &&
+           (data = malloc(hdr.datalen)) != NULL &&
+           read(fd, data, hdr.datalen) == hdr.datalen;
+  close(fd);
+
+  //check it add up to the file before creating anything
+  const unsigned char *p = data, *end = data + (ok ? hdr.datalen : 0);
+  long long off = 0, n = 0;
+  while (ok && p < end) {
+    long long v = editorIndexVarint(&p, end);
+    if (v < 0 || (v & 3) == 3 || (v >> 2) > INT_MAX) ok = 0;
+    else off += (v >> 2) + (v & 3);
+    n++;
+  }
+  if (!ok || off != hdr.size || n != hdr.nrows) {
+    free(data);
+    return -1;
+  }
+
+  editorRowStoreReserve(hdr.nrows);
+  for (p = data, off = 0; p < end;) {
+    long long v = editorIndexVarint(&p, end);
+    editorAppendMappedRow(E.map + off, v >> 2);
+    off += (v >> 2) + (v & 3);
+  }
+  free(data);
+  return 0;
+}
+
+//store the index of the rows just created from E.map. failing only cost the next open a scan
+void editorIndexSave(const char *filename, struct stat *st) {
+  char *path = editorIndexPath(filename, 1);
+  if (path == NULL) return;
+  struct lineIndexHeader hdr;
+  editorIndexHeader(&hdr, st);
+  hdr.nrows = E.numrows;
+
+  struct abuf ab = ABUF_INIT;
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    long long start = row->chars - E.map;
+    long long next = j + 1 < E.numrows ? editorRowAt(j + 1)->chars - E.map : (long long)E.maplen;
+    unsigned long long v = (unsigned long long)row->size << 2 | (next - start - row->size);
+    unsigned char buf[10];
+    int len = 0;
+    do {
+      buf[len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+      v >>= 7;
+    } while (v);
+    abAppend(&ab, (char *)buf, len);
+  }
+  hdr.datalen = ab.len;
+
+  //written next to it and renamed, so another kilo never read half an index
+  size_t tmplen = strlen(path) + 8;
+  char *tmp = malloc(tmplen);
+  snprintf(tmp, tmplen, "%s.XXXXXX", path);
+  int fd = mkstemp(tmp);
+  if (fd != -1) {
+    int ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && write(fd, ab.b, ab.len) == ab.len;
+    if (close(fd) == -1 || !ok || rename(tmp, path) == -1) unlink(tmp);
+  }
+  free(tmp);
+  abFree(&ab);
+  free(path);
+}
+
+//map the whole file read-only and create one row per line pointing into the mapping.
+//nothing is copied, so opening cost one pass of memchr() over the file no matter how big it is.
+//return -1 if the file can't be mapped (pipe, empty file...) so the caller can fall back to getline()
+int editorOpenMapped(int fd, const char *filename) {
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) return -1;
+
+  char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) return -1;
+  E.map = map;
+  E.maplen = st.st_size;
+  int indexed = st.st_size >= KILO_INDEX_MIN_BYTES;
+  if (indexed && editorIndexLoad(filename, &st) == 0) {
+    madvise(map, st.st_size, MADV_RANDOM); //pages are only read when their rows are shown
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL); //we read it front to back once to find the lines
+
+  char *p = map;
+  char *end = map + st.st_size;
+  while (p < end) {
+    char *nl = memchr(p, '\n', end - p);
+    char *eol = nl ? nl : end;
+    size_t linelen = eol - p;
+    if (linelen > 0 && p[linelen - 1] == '\r') linelen--;
+    editorAppendMappedRow(p, linelen);
+    p = nl ? nl + 1 : end;
+  }
+  madvise(map, st.st_size, MADV_RANDOM); //after that rows are only touched when drawn or edited
+  if (indexed) editorIndexSave(filename, &st);
+  return 0;
+}
+
+//copy every mapped row into the heap and drop the mapping. needed before the file
+//under the mapping get rewritten, otherwise the rows would change (or SIGBUS) under us
+void editorDetachMap(void) {
+  if (E.map == NULL) return;
+  int j;
+  for (j = 0; j < E.numrows; j++) editorRowOwn(editorRowAt(j));
+  munmap(E.map, E.maplen);
+  E.map = NULL;
+  E.maplen = 0;
+}
+
+//take file name and open the file, if blank open blank file.
+//return -1 with errno set if it can't be read, the buffer is then empty
+int editorOpenFile(char *filename) {
+  //set filename when open file
+  free(E.filename);
+  E.filename = strdup(filename); //strdup() from <string.h> copy the given string and allocate the required memory, assume you are free()
+  editorFreeRows(); //close whatever buffer was open before
+  editorSelectSyntaxHighlight();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) return -1;
+  if (editorOpenMapped(fd, filename) == 0) {
+    close(fd); //the mapping keep its own reference to the file
+    E.dirty = 0;
+    return 0;
+  }
+
+  FILE *fp = fdopen(fd, "r");
+  if (!fp) {
+    close(fd);
+    return -1;
+  }
+
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    //strip off newline carriage becuase erow = one line of text so no use for storing newline character
+    while (linelen > 0 && (line[linelen - 1] == '\n' || 
+                           line[linelen - 1] == '\r'))
+      linelen--;
+    editorInsetRow(E.numrows, line, linelen);
+  } 
+  free(line);
+  int err = ferror(fp) ? errno : 0; //a directory, an I/O error
+  fclose(fp);
+  E.dirty = 0;
+  if (err) {
+    editorFreeRows();
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+void editorOpen(char *filename) {
+  if (editorOpenFile(filename) == -1) die("open");
+}
+
+//seconds from a monotonic clock, for timing
+double editorNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//where editorWriteRows() get the rows from: the live buffer or a save snapshot
+typedef void (*rowSource)(void *ctx, int j, char **chars, int *size);
+
+void editorRowSourceBuffer(void *ctx, int j, char **chars, int *size) {
+  (void)ctx;
+  erow *row = editorRowAt(j);
+  *chars = row->chars;
+  *size = row->size;
+}
+
+void editorRowSourceSnapshot(void *ctx, int j, char **chars, int *size) {
+  struct saveJob *job = ctx;
+  *chars = job->rows[j].chars;
+  *size = job->rows[j].size;
+}
+
+//write nrows rows followed by a newline to fd. rows are handed to writev() straight from
+//their chars (heap or file mapping) in batches of IOV_MAX buffers, nothing is copied.
+//neighbouring mapped rows are merged with the newline between them in the mapping.
+//progress (if not NULL) is updated after every batch.
+//return the number of bytes written or -1 on error
+long long editorWriteRows(int fd, int nrows, rowSource src, void *ctx, atomic_llong *progress) {
+  static char newline = '\n';
+  struct iovec iov[IOV_MAX];
+  char *map = E.map, *mapend = E.map + E.maplen;
+  long long total = 0;
+  int j = 0;
+  while (j < nrows) {
+    int n = 0;
+    while (j < nrows && n + 2 <= IOV_MAX) {
+      char *chars;
+      int size;
+      src(ctx, j++, &chars, &size);
+      //untouched rows of the file mapping come back to back with their newline in between,
+      //they share one buffer so a big clean file is a few writev() calls, not millions of iovecs
+      if (map && chars >= map && chars + size < mapend && chars[size] == '\n') {
+        if (n > 0 && (char *)iov[n - 1].iov_base + iov[n - 1].iov_len == chars) {
+          iov[n - 1].iov_len += size + 1;
+        } else {
+          iov[n].iov_base = chars;
+          iov[n].iov_len = size + 1;
+          n++;
+        }
+        continue;
+      }
+      if (size > 0) {
+        iov[n].iov_base = chars;
+        iov[n].iov_len = size;
+        n++;
+      }
+      iov[n].iov_base = &newline;
+      iov[n].iov_len = 1;
+      n++;
+    }
+
+    //writev() can stop early, skip what was written and go again
+    struct iovec *v = iov;
+    while (n > 0) {
+      ssize_t w = writev(fd, v, n);
+      if (w == -1) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      total += w;
+      while (n > 0 && (size_t)w >= v->iov_len) {
+        w -= v->iov_len;
+        v++;
+        n--;
+      }
+      if (n > 0) {
+        v->iov_base = (char *)v->iov_base + w;
+        v->iov_len -= w;
+      }
+    }
+    if (progress) atomic_store(progress, total);
+  }
+  return total;
+}
+
+//the file a save of filename should replace: symlinks resolved, so the link stay a link.
+//realpath() fails on a link to a file that doesn't exist yet, those are followed by hand
+char *editorSaveTarget(const char *filename) {
+  char *target = realpath(filename, NULL);
+  if (target) return target;
+  target = strdup(filename);
+  int hops;
+  struct stat st;
+  for (hops = 0; hops < 40 && lstat(target, &st) == 0 && S_ISLNK(st.st_mode); hops++) {
+    size_t cap = st.st_size > 0 ? st.st_size + 1 : PATH_MAX; //st_size is the length of the link
+    char *link = malloc(cap);
+    ssize_t n = readlink(target, link, cap - 1);
+    if (n == -1) {
+      free(link);
+      break;
+    }
+    link[n] = '\0';
+    char *slash = strrchr(target, '/');
+    if (link[0] != '/' && slash) {
+      //relative to the directory of the link
+      size_t dirlen = slash - target + 1;
+      char *path = malloc(dirlen + n + 1);
+      memcpy(path, target, dirlen);
+      memcpy(path + dirlen, link, n + 1);
+      free(link);
+      link = path;
+    }
+    free(target);
+    target = link;
+  }
+  return target;
+}
+
+//open target to be rewritten in place, the rows can't point into it anymore
+int editorSaveOpenInPlace(const char *target) {
+  editorDetachMap();
+  return open(target, O_WRONLY);
+}
+
+//open what the save of filename write to. *target is the real file behind filename (see
+//editorSaveTarget()) and *tmp a temporary file next to it, with the owner and permission of
+//the file it will replace (0666 less the umask for a new one, like open() would give).
+//a file with hard links is written in place instead, *tmp is then NULL: rename() would leave
+//the other names on the old file. so is a file we can't give back to its owner. free both
+int editorSaveOpenTemp(const char *filename, char **tmp, char **target) {
+  *target = editorSaveTarget(filename);
+  *tmp = NULL;
+  struct stat st;
+  int exists = stat(*target, &st) == 0;
+  int fd = -1;
+  if (exists && st.st_nlink > 1) {
+    fd = editorSaveOpenInPlace(*target);
+  } else {
+    size_t tmplen = strlen(*target) + 16;
+    *tmp = malloc(tmplen);
+    snprintf(*tmp, tmplen, "%s.kilo-XXXXXX", *target);
+    fd = mkstemp(*tmp);
+    if (fd != -1 && fchmod(fd, exists ? (st.st_mode & 07777) : (0666 & ~E.umask)) == -1) {
+      int err = errno;
+      close(fd);
+      unlink(*tmp);
+      fd = -1;
+      errno = err;
+    } else if (fd != -1 && exists && (st.st_uid != geteuid() || st.st_gid != getegid()) &&
+               fchown(fd, st.st_uid, st.st_gid) == -1) {
+      //only root can give a file away. writing in place keep the owner
+      close(fd);
+      unlink(*tmp);
+      free(*tmp);
+      *tmp = NULL;
+      fd = editorSaveOpenInPlace(*target);
+    }
+  }
+  if (fd == -1) {
+    int err = errno;
+    free(*tmp);
+    free(*target);
+    *tmp = NULL;
+    *target = NULL;
+    errno = err;
+  }
+  return fd;
+}
+
+//fsync() and close the temporary file and rename() it over target. the temporary file is
+//removed on failure. written in place (tmp is NULL), cut target to len instead.
+//return 0 or the errno of the failure
+int editorSaveFinish(int fd, char *tmp, const char *target, long long len) {
+  if (tmp == NULL) {
+    int ok = len != -1 && ftruncate(fd, len) != -1 && fsync(fd) != -1;
+    int err = errno;
+    if (close(fd) == -1 && ok) return errno;
+    return ok ? 0 : err;
+  }
+  if (len != -1 && fsync(fd) != -1 && close(fd) != -1) {
+    fd = -1;
+    if (rename(tmp, target) != -1) return 0;
+  }
+  int err = errno;
+  if (fd != -1) close(fd);
+  unlink(tmp);
+  return err;
+}
+
+void editorSaveReport(long long len, double secs) {
+  if (len >= 1024 * 1024 && secs > 0)
+    editorSetStatusMessage("%lld bytes written to disk (%.1f MB/s)", len, len / secs / 1e6);
+  else
+    editorSetStatusMessage("%lld bytes written to disk", len);
+}
+
+void *editorSaveThread(void *arg) {
+  struct saveJob *job = arg;
+  long long len = editorWriteRows(job->fd, job->nrows, editorRowSourceSnapshot, job, &job->written);
+  job->err = editorSaveFinish(job->fd, job->tmp, job->filename, len);
+  atomic_store(&job->done, 1);
+  editorWake();
+  return NULL;
+}
+
+//take the snapshot and start the save thread. O(rows) to copy the pointers, nothing else.
+//the job take tmp and target (from editorSaveOpenTemp())
+void editorSaveAsync(int fd, char *tmp, char *target, long long total) {
+  struct saveJob *job = calloc(1, sizeof(struct saveJob));
+  if (job == NULL) die("calloc");
+  job->filename = target;
+  job->tmp = tmp;
+  job->fd = fd;
+  job->nrows = E.numrows;
+  job->rows = malloc(sizeof(struct saveRow) * (E.numrows ? E.numrows : 1));
+  if (job->rows == NULL) die("malloc");
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    job->rows[j].chars = row->chars;
+    job->rows[j].size = row->size;
+    if (!(row->flags & ROW_MAPPED)) row->flags |= ROW_SHARED; //mapped rows are never written in place anyway
+  }
+  job->total = total;
+  job->dirty = E.dirty;
+  job->start = editorNow();
+  E.save = job;
+  if (pthread_create(&job->thread, NULL, editorSaveThread, job) != 0) die("pthread_create");
+  editorSetStatusMessage("Saving in the background...");
+}
+
+//keep a buffer replaced during the background save alive until the save is done
+void editorSaveOrphan(void *p, int cap) {
+  struct saveJob *job = E.save;
+  if (job->norphans == job->orphancap) {
+    job->orphancap = job->orphancap ? job->orphancap * 2 : 64;
+    job->orphans = realloc(job->orphans, sizeof(struct saveOrphan) * job->orphancap);
+    if (job->orphans == NULL) die("realloc");
+  }
+  job->orphans[job->norphans].p = p;
+  job->orphans[job->norphans].cap = cap;
+  job->norphans++;
+}
+
+//the save thread is joined: give the rows back their buffers and report the result
+void editorSaveDone(void) {
+  struct saveJob *job = E.save;
+  int j;
+  for (j = 0; j < E.numrows; j++) editorRowAt(j)->flags &= ~ROW_SHARED;
+  for (j = 0; j < job->norphans; j++) slabFree(job->orphans[j].p, job->orphans[j].cap);
+  if (job->err == 0) {
+    E.dirty -= job->dirty; //only edits made during the save are left
+    editorSaveReport(atomic_load(&job->written), editorNow() - job->start);
+    editorFollowRearm();
+  } else {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+  }
+  free(job->orphans);
+  free(job->rows);
+  free(job->tmp);
+  free(job->filename);
+  free(job);
+  E.save = NULL;
+}
+
+//called from the main loop: show progress, and clean up once the save thread is done
+void editorSavePoll(void) {
+  struct saveJob *job = E.save;
+  if (job == NULL) return;
+  if (!atomic_load(&job->done)) {
+    editorSetStatusMessage("Saving... %d%%",
+      job->total ? (int)(atomic_load(&job->written) * 100 / job->total) : 0);
+    return;
+  }
+  pthread_join(job->thread, NULL);
+  editorSaveDone();
+}
+
+//block until the background save is finished (quit, closing the buffer)
+void editorSaveWait(void) {
+  if (E.save == NULL) return;
+  pthread_join(E.save->thread, NULL);
+  editorSaveDone();
+}
+
+//save into a temporary file next to the real one, fsync() it and rename() it over the original.
+//a crash in the middle leave the old file untouched, and the file we have mapped is never
+//modified (rename only swap the name to the new inode) so mapped rows stay valid.
+//big buffers are written by a background thread so editing can continue
+void editorSave(void) {
+  if (E.save) {
+    editorSetStatusMessage("A save is already in progress");
+    return;
+  }
+  //the save replace the file with a new one, follow mode move to it once the save is done
+  //(editorFollowRearm()). a pipe keep streaming, the save only has what came so far
+  if (E.filename == NULL) {
+    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+    if (E.filename == NULL) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+    editorSelectSyntaxHighlight();
+  }
+
+  double start = editorNow();
+  char *tmp, *target;
+  int fd = editorSaveOpenTemp(E.filename, &tmp, &target);
+  if (fd == -1) {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    return;
+  }
+
+  long long total = 0;
+  int j;
+  for (j = 0; j < E.numrows; j++) total += editorRowAt(j)->size + 1;
+  if (total >= KILO_ASYNC_SAVE_BYTES) {
+    editorSaveAsync(fd, tmp, target, total);
+    return;
+  }
+
+  long long len = editorWriteRows(fd, E.numrows, editorRowSourceBuffer, NULL, NULL);
+  int err = editorSaveFinish(fd, tmp, target, len);
+  free(tmp);
+  free(target);
+  if (err == 0) {
+    E.dirty = 0;
+    editorSaveReport(len, editorNow() - start);
+    editorFollowRearm();
+  } else {
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(err));
+  }
+}
+
+/*** follow ***/
+
+//read what was appended to the followed file since last time, at most KILO_FOLLOW_CHUNK bytes
+//so a burst doesn't freeze the screen. a cursor on the last row stay on the last row.
+//return 1 if there may be more to read, -1 at the end of a stream
+int editorFollowRead(void) {
+  static char buf[64 * 1024];
+  struct followState *f = &E.follow;
+  int dirty = E.dirty;
+  int tail = E.cy >= E.numrows - 1;
+  size_t total = 0;
+  int eof = 0;
+  while (total < KILO_FOLLOW_CHUNK) {
+    ssize_t n = read(f->fd, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && errno == EAGAIN) f->armed = 1; //a pipe with nothing in it yet
+    else if (n <= 0 && f->stream) eof = 1;
+    if (n <= 0) break;
+    f->offset += n;
+    total += n;
+    char *p = buf, *end = buf + n;
+    while (p < end) {
+      char *nl = memchr(p, '\n', end - p);
+      char *eol = nl ? nl : end;
+      //a line cut by the writer (or by our buffer) is finished by the next bytes
+      if (f->partial && E.numrows > 0 && E.edits == f->partialedits) editorRowAppendString(editorRowAt(E.numrows - 1), p, eol - p);
+      else editorInsetRow(E.numrows, p, eol - p);
+      f->partial = nl == NULL;
+      if (nl) {
+        erow *last = editorRowAt(E.numrows - 1);
+        if (last->size > 0 && last->chars[last->size - 1] == '\r') editorRowTruncate(last, last->size - 1);
+      }
+      p = nl ? nl + 1 : end;
+      f->partialedits = E.edits;
+    }
+  }
+  E.dirty = dirty; //the new rows are already in the file
+  if (tail && E.numrows > 0 && E.cy != E.numrows - 1) {
+    E.cy = E.numrows - 1;
+    E.cx = 0;
+  }
+  if (eof) return -1;
+  return total >= KILO_FOLLOW_CHUNK;
+}
+
+//watch the file E.filename now name, the old watch went with the old file
+void editorFollowWatch(void) {
+#ifdef KILO_INOTIFY
+  struct followState *f = &E.follow;
+  if (f->inotify != -1) {
+    if (f->wd != -1) inotify_rm_watch(f->inotify, f->wd);
+    f->wd = inotify_add_watch(f->inotify, E.filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+  }
+#endif
+}
+
+//(re)open E.filename and load it from the start, the cursor following its end.
+//return -1 if it can't be opened
+int editorFollowOpen(void) {
+  struct followState *f = &E.follow;
+  int fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return -1;
+  struct stat st;
+  fstat(fd, &st);
+  if (f->fd != -1) close(f->fd);
+  f->fd = fd;
+  f->ino = st.st_ino;
+  f->dev = st.st_dev;
+  f->offset = 0;
+  f->partial = 0;
+  editorFollowWatch();
+  editorFreeRows();
+  E.cx = 0;
+  E.cy = 0;
+  E.rowoff = 0;
+  E.coloff = 0;
+  if (editorFollowRead() > 0) editorWake();
+  E.dirty = 0;
+  return 0;
+}
+
+//a save replaced the followed file with the buffer: follow the new file from its end.
+//if it can't be opened follow mode is turned off, and say so
+void editorFollowRearm(void) {
+  struct followState *f = &E.follow;
+  if (f->fd == -1 || f->stream) return;
+  struct stat st;
+  int fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1) close(fd);
+    editorFollowStop();
+    editorSetStatusMessage("follow stopped (file saved)");
+    return;
+  }
+  close(f->fd);
+  f->fd = fd;
+  f->ino = st.st_ino;
+  f->dev = st.st_dev;
+  f->offset = st.st_size;
+  f->partial = 0; //every row was written with its newline
+  editorFollowWatch();
+}
+
+//open filename in follow mode. rows are read into the heap rather than mapped: the file may be
+//truncated under us, and a mapped row past the new end would SIGBUS when drawn
+void editorFollow(char *filename) {
+  struct followState *f = &E.follow;
+  free(E.filename);
+  E.filename = strdup(filename);
+  editorSelectSyntaxHighlight();
+#ifdef KILO_INOTIFY
+  f->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (f->inotify != -1) {
+    //logrotate rename the file and create a new one, only the directory see the new one arrive
+    char *dir = strdup(filename);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) strcpy(dir, ".");
+    else slash[slash == dir] = '\0'; //keep the / of a file at the root
+    f->dirwd = inotify_add_watch(f->inotify, dir, IN_CREATE | IN_MOVED_TO);
+    free(dir);
+  }
+#endif
+  if (editorFollowOpen() == -1) die("open");
+}
+
+//stream a pipe into an empty buffer (kilo -, cmd | kilo -). the main loop append rows in
+//batches as they come, so the editor is usable (and search see what came so far) right away
+void editorStream(int fd) {
+  struct followState *f = &E.follow;
+  free(E.filename);
+  E.filename = NULL; //saving ask for a name
+  editorFreeRows();
+  editorSelectSyntaxHighlight();
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  f->fd = fd;
+  f->stream = 1;
+  f->offset = 0;
+  f->partial = 0;
+  f->armed = 1;
+  E.dirty = 0;
+}
+
+//read all of a pipe before returning, for batch mode (kilo --script edits.txt -)
+void editorStreamAll(int fd) {
+  editorStream(fd);
+  while (editorFollowRead() != -1) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (E.follow.armed) poll(&pfd, 1, -1);
+    E.follow.armed = 0;
+  }
+  editorFollowStop();
+  E.cx = 0;
+  E.cy = 0;
+}
+
+//leave follow mode or stop reading the pipe, the buffer stays as it is
+void editorFollowStop(void) {
+  struct followState *f = &E.follow;
+  if (f->fd == -1) return;
+  close(f->fd);
+  if (f->inotify != -1) close(f->inotify); //drop the watches with it
+  f->fd = -1;
+  f->inotify = -1;
+  f->wd = -1;
+  f->dirwd = -1;
+  f->stream = 0;
+  f->armed = 0;
+}
+
+//called from the main loop: append what the file got, and start over when it was truncated
+//or rotated. a buffer with edits is never thrown away, follow mode is turned off instead
+void editorFollowCheck(void) {
+  struct followState *f = &E.follow;
+  if (f->fd == -1) return;
+  if (E.save && !f->stream) return; //our own save is replacing the file, it is followed after
+  if (f->stream) {
+    if (f->armed) return; //nothing new since the pipe was found empty
+    int more = editorFollowRead();
+    if (more == -1) {
+      editorFollowStop();
+      editorSetStatusMessage("%d lines read (%lld bytes)", E.numrows, (long long)f->offset);
+    } else if (more) {
+      editorWake();
+    }
+    return;
+  }
+  struct stat st;
+  const char *what = NULL;
+  if (fstat(f->fd, &st) == 0 && st.st_size < f->offset) {
+    what = "truncated";
+  } else {
+    if (editorFollowRead() > 0) editorWake();
+    //rotated: the name now point to a new file. what the old one got before that is read above
+    if (stat(E.filename, &st) == 0 && (st.st_ino != f->ino || st.st_dev != f->dev)) what = "rotated";
+  }
+  if (what == NULL) return;
+  if (E.dirty) {
+    editorFollowStop();
+    editorSetStatusMessage("%s was %s, follow mode off to keep your changes", E.filename, what);
+  } else if (editorFollowOpen() == -1) {
+    editorSetStatusMessage("%s was %s and can't be reopened: %s", E.filename, what, strerror(errno));
+  } else {
+    editorSetStatusMessage("%s was %s, reloaded", E.filename, what);
+  }
+}
+
+/*** undo ***/
+
+//where text inserted at (y, x) end
+void editorUndoEnd(int y, int x, const char *s, int len, int *ey, int *ex) {
+  int j;
+  for (j = 0; j < len; j++) {
+    if (s[j] == '\n') {
+      y++;
+      x = 0;
+    } else {
+      x++;
+    }
+  }
+  *ey = y;
+  *ex = x;
+}
+
+void editorUndoFree(struct undoRecord *r) {
+  E.undo.bytes -= r->text.cap + sizeof(struct undoRecord);
+  abFree(&r->text);
+}
+
+//drop every record from the one at index `from`
+void editorUndoTruncate(int from) {
+  struct undoLog *u = &E.undo;
+  int j;
+  for (j = from; j < u->len; j++) editorUndoFree(&u->recs[j]);
+  u->len = from;
+  if (u->pos > from) u->pos = from;
+}
+
+void editorUndoClear(void) {
+  editorUndoTruncate(0);
+  free(E.undo.recs);
+  memset(&E.undo, 0, sizeof(E.undo));
+}
+
+//merge a keystroke into the last record when it continue it: typing after the last insert,
+//backspace right before the last delete or delete at the same place. a new line start a new step
+int editorUndoCoalesce(int type, int y, int x, const char *s, int len, int eof) {
+  struct undoLog *u = &E.undo;
+  if (!u->open || u->pos != u->len || u->len == 0 || eof || len != 1) return 0;
+  struct undoRecord *r = &u->recs[u->len - 1];
+  if (r->type != type || r->text.len == 0 || r->text.len >= KILO_UNDO_COALESCE_MAX) return 0;
+  if (s[0] == '\n' || r->text.b[r->text.len - 1] == '\n' || r->text.b[0] == '\n') return 0;
+
+  int oldcap = r->text.cap;
+  if (type == UNDO_INSERT && y == r->ey && x == r->ex) {
+    abAppend(&r->text, s, 1);
+    r->ex++;
+  } else if (type == UNDO_DELETE && y == r->y && x == r->x) {
+    abAppend(&r->text, s, 1); //Delete key, the text after is pulled under the cursor
+    r->ex++;
+  } else if (type == UNDO_DELETE && y == r->y && x + 1 == r->x) {
+    abAppend(&r->text, s, 1); //Backspace, the deleted char goes in front
+    memmove(&r->text.b[1], r->text.b, r->text.len - 1);
+    r->text.b[0] = s[0];
+    r->x = x;
+  } else {
+    return 0;
+  }
+  u->bytes += r->text.cap - oldcap;
+  return 1;
 }
 
-void editorDelChar(void) {
-  if (E.cy == E.numrows) return;
-  if (E.cx == 0 && E.cy == 0) return;
+//log an edit about to be made. called by the editor operations, not by undo/redo themselves
+void editorUndoRecord(int type, int y, int x, const char *s, int len) {
+  struct undoLog *u = &E.undo;
+  if (u->replaying) return;
+  int eof = type == UNDO_INSERT && y == E.numrows;
+  editorUndoTruncate(u->pos); //the redo part is lost once the buffer change
+
+  if (!editorUndoCoalesce(type, y, x, s, len, eof)) {
+    if (u->len == u->cap) {
+      u->cap = u->cap ? u->cap * 2 : 64;
+      u->recs = realloc(u->recs, sizeof(struct undoRecord) * u->cap);
+      if (u->recs == NULL) die("realloc");
+    }
+    struct undoRecord *r = &u->recs[u->len++];
+    r->type = type;
+    r->eof = eof;
+    r->y = y;
+    r->x = x;
+    editorUndoEnd(y, x, s, len, &r->ey, &r->ex);
+    r->cy = E.cy;
+    r->cx = E.cx;
+    r->text.b = NULL;
+    r->text.len = 0;
+    r->text.cap = 0;
+    abAppend(&r->text, s, len);
+    u->bytes += r->text.cap + sizeof(struct undoRecord);
+    u->pos = u->len;
+    u->open = 1;
+  }
 
-  erow *row = &E.row[E.cy];
-  if (E.cx > 0) {
-    editorRowDelChar(row, E.cx - 1);
-    E.cx--;
+  //over the budget: forget the oldest steps. a single edit bigger than the budget can't be undone
+  int drop = 0;
+  while (drop < u->len && u->bytes > KILO_UNDO_MAX_BYTES) editorUndoFree(&u->recs[drop++]);
+  if (drop > 0) {
+    memmove(u->recs, &u->recs[drop], sizeof(struct undoRecord) * (u->len - drop));
+    u->len -= drop;
+    u->pos -= drop;
+    if (u->len == 0) u->open = 0;
+  }
+}
+
+//revert the last step. only the text of the step is touched, the cost doesn't depend on the buffer size
+void editorUndo(void) {
+  struct undoLog *u = &E.undo;
+  if (u->pos == 0) {
+    editorSetStatusMessage("Nothing to undo");
+    return;
+  }
+  struct undoRecord *r = &u->recs[--u->pos];
+  u->replaying = 1;
+  if (r->type == UNDO_INSERT) {
+    editorDeleteText(r->y, r->x, r->text.len);
+    if (r->eof) editorDelRow(r->y);
   } else {
-    E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-    editorDelRow(E.cy);
-    E.cy--;
+    E.cy = r->y;
+    E.cx = r->x;
+    editorInsertText(r->text.b, r->text.len);
   }
+  u->replaying = 0;
+  u->open = 0;
+  E.cy = r->cy;
+  E.cx = r->cx;
 }
 
-void editorInsertNewLine(void) {
-  if (E.cx ==0) {
-    editorInsetRow(E.cy, "", 0);
+void editorRedo(void) {
+  struct undoLog *u = &E.undo;
+  if (u->pos == u->len) {
+    editorSetStatusMessage("Nothing to redo");
+    return;
+  }
+  struct undoRecord *r = &u->recs[u->pos++];
+  u->replaying = 1;
+  if (r->type == UNDO_INSERT) {
+    E.cy = r->y;
+    E.cx = r->x;
+    if (r->eof && r->text.len == 0) editorInsetRow(r->y, "", 0);
+    else editorInsertText(r->text.b, r->text.len);
+    E.cy = r->ey;
+    E.cx = r->ex;
   } else {
-    erow *row = &E.row[E.cy];
-    editorInsetRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-    row = &E.row[E.cy];
-    row->size = E.cx;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
+    editorDeleteText(r->y, r->x, r->text.len);
+    E.cy = r->y;
+    E.cx = r->x;
   }
-  E.cy++;
-  E.cx = 0;
+  u->replaying = 0;
+  u->open = 0;
 }
 
+/*** regex ***/
 
+//parse tree of a regex, compiled to an nfa by regexCompileNode()
+enum reNodeType { RE_SET, RE_CAT, RE_ALT, RE_STAR, RE_PLUS, RE_QUEST, RE_EMPTY, RE_BOL, RE_EOL };
 
-/*** file I/O ***/
+struct reNode {
+  int type;
+  struct reNode *a, *b;
+  unsigned char set[32];
+};
 
-//turn every rows in to one big text buffer
-char *editorRowToString(int *buflen) {
-  int totlen = 0;
+struct reParser {
+  const char *p;
+  const char *end;
+  int error;
+};
+
+void reSetAdd(unsigned char *set, int c) {
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+int reSetHas(const unsigned char *set, int c) {
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+struct reNode *reNewNode(int type, struct reNode *a, struct reNode *b) {
+  struct reNode *n = calloc(1, sizeof(struct reNode));
+  if (n == NULL) die("calloc");
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return n;
+}
+
+void reFreeNode(struct reNode *n) {
+  if (n == NULL) return;
+  reFreeNode(n->a);
+  reFreeNode(n->b);
+  free(n);
+}
+
+//add the bytes of \d \w \s (and their upper case negation) or the escaped byte itself
+void reParseEscape(int c, unsigned char *set) {
+  unsigned char tmp[32] = {0};
+  int neg = isupper(c);
   int j;
-  for (j = 0; j < E.numrows; j++)
-    totlen += E.row[j].size + 1;
-  *buflen = totlen;
+  switch (tolower(c)) {
+    case 'd': for (j = '0'; j <= '9'; j++) reSetAdd(tmp, j); break;
+    case 'w':
+      for (j = 0; j < 256; j++) if (isalnum(j) || j == '_') reSetAdd(tmp, j);
+      break;
+    case 's': for (j = 0; j < 256; j++) if (isspace(j)) reSetAdd(tmp, j); break;
+    case 't': reSetAdd(set, '\t'); return;
+    default: reSetAdd(set, c); return;
+  }
+  for (j = 0; j < 32; j++) set[j] |= neg ? ~tmp[j] : tmp[j];
+}
 
-  char *buf = malloc(totlen);
-  char *p = buf;
-  for (j = 0; j < E.numrows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+struct reNode *reParseAlt(struct reParser *ps);
+
+//[abc] [a-z] [^...], a ] right after [ or [^ is a literal
+struct reNode *reParseClass(struct reParser *ps) {
+  struct reNode *n = reNewNode(RE_SET, NULL, NULL);
+  int neg = 0;
+  if (ps->p < ps->end && *ps->p == '^') {
+    neg = 1;
+    ps->p++;
+  }
+  int first = 1;
+  while (ps->p < ps->end && (*ps->p != ']' || first)) {
+    int c = (unsigned char)*ps->p++;
+    first = 0;
+    if (c == '\\' && ps->p < ps->end) {
+      reParseEscape((unsigned char)*ps->p++, n->set);
+      continue;
+    }
+    if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+      int hi = (unsigned char)ps->p[1];
+      ps->p += 2;
+      for (; c <= hi; c++) reSetAdd(n->set, c);
+      continue;
+    }
+    reSetAdd(n->set, c);
+  }
+  if (ps->p == ps->end) ps->error = 1; //missing ]
+  else ps->p++;
+  if (neg) {
+    int j;
+    for (j = 0; j < 32; j++) n->set[j] = ~n->set[j];
+  }
+  return n;
+}
+
+struct reNode *reParseAtom(struct reParser *ps) {
+  int c = (unsigned char)*ps->p++;
+  struct reNode *n;
+  switch (c) {
+    case '(':
+      n = reParseAlt(ps);
+      if (ps->p < ps->end && *ps->p == ')') ps->p++;
+      else ps->error = 1;
+      return n;
+    case '[':
+      return reParseClass(ps);
+    case '.':
+      n = reNewNode(RE_SET, NULL, NULL);
+      memset(n->set, 0xff, sizeof(n->set));
+      return n;
+    case '\\':
+      n = reNewNode(RE_SET, NULL, NULL);
+      if (ps->p < ps->end) reParseEscape((unsigned char)*ps->p++, n->set);
+      else reSetAdd(n->set, '\\');
+      return n;
+    case '^':
+      return reNewNode(RE_BOL, NULL, NULL);
+    case '$':
+      return reNewNode(RE_EOL, NULL, NULL);
+    case '*': case '+': case '?': case ')':
+      ps->error = 1; //nothing to repeat / unbalanced
+      return reNewNode(RE_EMPTY, NULL, NULL);
+    default:
+      n = reNewNode(RE_SET, NULL, NULL);
+      reSetAdd(n->set, c);
+      return n;
   }
+}
 
-  return buf;
+//atom followed by any number of * + ?
+struct reNode *reParseRepeat(struct reParser *ps) {
+  struct reNode *n = reParseAtom(ps);
+  while (ps->p < ps->end && strchr("*+?", *ps->p)) {
+    int op = *ps->p++;
+    n = reNewNode(op == '*' ? RE_STAR : op == '+' ? RE_PLUS : RE_QUEST, n, NULL);
+  }
+  return n;
 }
 
-//take file name and open the file, if blank open blank file
-void editorOpen(char *filename) {
-  //set filename when open file
-  free(E.filename);
-  E.filename = strdup(filename); //strdup() from <string.h> copy the given string and allocate the required memory, assume you are free()
+struct reNode *reParseCat(struct reParser *ps) {
+  struct reNode *n = NULL;
+  while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+    struct reNode *r = reParseRepeat(ps);
+    n = n ? reNewNode(RE_CAT, n, r) : r;
+  }
+  return n ? n : reNewNode(RE_EMPTY, NULL, NULL);
+}
 
+struct reNode *reParseAlt(struct reParser *ps) {
+  struct reNode *n = reParseCat(ps);
+  while (ps->p < ps->end && *ps->p == '|') {
+    ps->p++;
+    n = reNewNode(RE_ALT, n, reParseCat(ps));
+  }
+  return n;
+}
 
-  FILE *fp = fopen(filename, "r");
-  if (!fp) die("fopen");
+int nfaAdd(struct nfa *nfa, int type, int out, int out1) {
+  if (nfa->nst == nfa->cap) {
+    nfa->cap = nfa->cap ? nfa->cap * 2 : 16;
+    nfa->st = realloc(nfa->st, sizeof(struct nfaState) * nfa->cap);
+    if (nfa->st == NULL) die("realloc");
+  }
+  struct nfaState *st = &nfa->st[nfa->nst];
+  memset(st, 0, sizeof(*st));
+  st->type = type;
+  st->out = out;
+  st->out1 = out1;
+  return nfa->nst++;
+}
 
+//build the states for n so that every path through it continue to state next, return its first state.
+//working backward like this means there are no dangling arrows to patch later. with reverse set
+//concatenations are built right to left and ^ and $ swap, which give the nfa of the reversed regex
+int regexCompileNode(struct nfa *nfa, struct reNode *n, int next, int reverse) {
+  int s, start;
+  switch (n->type) {
+    case RE_SET:
+      s = nfaAdd(nfa, NFA_SET, next, -1);
+      memcpy(nfa->st[s].set, n->set, sizeof(n->set));
+      return s;
+    case RE_CAT:
+      if (reverse) return regexCompileNode(nfa, n->b, regexCompileNode(nfa, n->a, next, reverse), reverse);
+      return regexCompileNode(nfa, n->a, regexCompileNode(nfa, n->b, next, reverse), reverse);
+    case RE_ALT:
+      start = regexCompileNode(nfa, n->a, next, reverse);
+      s = regexCompileNode(nfa, n->b, next, reverse);
+      return nfaAdd(nfa, NFA_SPLIT, start, s);
+    case RE_QUEST:
+      start = regexCompileNode(nfa, n->a, next, reverse);
+      return nfaAdd(nfa, NFA_SPLIT, start, next);
+    case RE_STAR:
+      s = nfaAdd(nfa, NFA_SPLIT, -1, next);
+      start = regexCompileNode(nfa, n->a, s, reverse);
+      nfa->st[s].out = start;
+      return s;
+    case RE_PLUS:
+      s = nfaAdd(nfa, NFA_SPLIT, -1, next);
+      start = regexCompileNode(nfa, n->a, s, reverse);
+      nfa->st[s].out = start;
+      return start;
+    case RE_BOL:
+      return nfaAdd(nfa, reverse ? NFA_EOL : NFA_BOL, next, -1);
+    case RE_EOL:
+      return nfaAdd(nfa, reverse ? NFA_BOL : NFA_EOL, next, -1);
+    default: //RE_EMPTY
+      return nfaAdd(nfa, NFA_EMPTY, next, -1);
+  }
+}
 
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    //strip off newline carriage becuase erow = one line of text so no use for storing newline character
-    while (linelen > 0 && (line[linelen - 1] == '\n' || 
-                           line[linelen - 1] == '\r'))
-      linelen--;
-    editorInsetRow(E.numrows, line, linelen);
-  } 
-  free(line);
-  fclose(fp);
-  E.dirty = 0;
+//compile pattern, return NULL if it is not a valid regex. supported: literals, . [] [^] \d \w \s
+//(and \D \W \S), * + ? | ( ), and ^ $ anchors anywhere (like POSIX ERE, a|^b is a or b at the start)
+struct regex *regexCompile(const char *pattern) {
+  struct regex *re = calloc(1, sizeof(struct regex));
+  if (re == NULL) die("calloc");
+  struct reParser ps = {pattern, pattern + strlen(pattern), 0};
+  struct reNode *root = reParseAlt(&ps);
+  if (ps.p != ps.end) ps.error = 1; //stray )
+  if (!ps.error) {
+    re->fwd.start = regexCompileNode(&re->fwd, root, nfaAdd(&re->fwd, NFA_MATCH, -1, -1), 0);
+    re->rev.start = regexCompileNode(&re->rev, root, nfaAdd(&re->rev, NFA_MATCH, -1, -1), 1);
+  }
+  reFreeNode(root);
+  if (ps.error) {
+    free(re);
+    return NULL;
+  }
+  return re;
 }
 
-void editorSave(void) {
-  if (E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-    if (E.filename == NULL) {
-      editorSetStatusMessage("Save aborted");
-      return;
+void regexFree(struct regex *re) {
+  if (re == NULL) return;
+  free(re->fwd.st);
+  free(re->rev.st);
+  free(re);
+}
+
+int dfaClosure(struct dfa *d, int s, int *set, int n, int flags);
+void dfaClearMarks(struct dfa *d);
+
+void dfaInit(struct dfa *d, const struct nfa *nfa, int unanchored) {
+  d->nfa = nfa;
+  d->unanchored = unanchored;
+  d->states = calloc(KILO_DFA_MAX_STATES, sizeof(struct dfaState *));
+  d->nstates = 0;
+  d->hash = malloc(sizeof(int) * KILO_DFA_MAX_STATES * 2);
+  d->stack = malloc(sizeof(int) * nfa->nst);
+  d->mark = calloc(nfa->nst, 1);
+  d->buf = malloc(sizeof(int) * (nfa->nst + 1));
+  if (!d->states || !d->hash || !d->stack || !d->mark || !d->buf) die("malloc");
+  memset(d->hash, -1, sizeof(int) * KILO_DFA_MAX_STATES * 2);
+  //a pattern whose every path start with ^ can't start a match past the first byte,
+  //anchored the DFA can then give up on a row as soon as it stop matching
+  if (unanchored && dfaClosure(d, nfa->start, d->buf, 0, 0) == 0) d->unanchored = 0;
+  dfaClearMarks(d);
+}
+
+//drop every cached state, used when the cache is full
+void dfaFlush(struct dfa *d) {
+  int j;
+  for (j = 0; j < d->nstates; j++) {
+    free(d->states[j]->set);
+    free(d->states[j]);
+  }
+  d->nstates = 0;
+  memset(d->hash, -1, sizeof(int) * KILO_DFA_MAX_STATES * 2);
+}
+
+void dfaFree(struct dfa *d) {
+  dfaFlush(d);
+  free(d->states);
+  free(d->hash);
+  free(d->stack);
+  free(d->mark);
+  free(d->buf);
+}
+
+//where dfaClosure() is in the text: ^ is only passed with DFA_AT_BOL, $ with DFA_AT_EOL
+#define DFA_AT_BOL 1
+#define DFA_AT_EOL 2
+
+//add state s and everything reachable from it without consuming a byte to set.
+//only NFA_SET, NFA_MATCH and (until the end of the text is seen) NFA_EOL states are kept,
+//they are the only ones that matter for the next step
+int dfaClosure(struct dfa *d, int s, int *set, int n, int flags) {
+  const struct nfaState *st = d->nfa->st;
+  int sp = 0;
+  if (d->mark[s]) return n;
+  d->mark[s] = 1;
+  d->stack[sp++] = s;
+  while (sp > 0) {
+    int cur = d->stack[--sp];
+    int outs[2] = {-1, -1};
+    if (st[cur].type == NFA_SPLIT) {
+      outs[0] = st[cur].out;
+      outs[1] = st[cur].out1;
+    } else if (st[cur].type == NFA_EMPTY) {
+      outs[0] = st[cur].out;
+    } else if (st[cur].type == NFA_BOL) {
+      if (flags & DFA_AT_BOL) outs[0] = st[cur].out; //else the path is dead
+    } else if (st[cur].type == NFA_EOL && (flags & DFA_AT_EOL)) {
+      outs[0] = st[cur].out;
+    } else {
+      set[n++] = cur;
+    }
+    int k;
+    for (k = 0; k < 2; k++) {
+      if (outs[k] >= 0 && !d->mark[outs[k]]) {
+        d->mark[outs[k]] = 1;
+        d->stack[sp++] = outs[k];
+      }
     }
   }
+  return n;
+}
 
-  int len;
-  char *buf = editorRowToString(&len);
+int dfaIntCmp(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
 
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644); //0644 is standard permission for a text file. owner can read and write, while every one else can only read
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", len);
-        return;
+//return the id of the DFA state for set (set[0..n) sorted), creating it if it is new
+int dfaLookup(struct dfa *d, int *set, int n) {
+  unsigned h = 2166136261u; //FNV-1a over the state numbers
+  int j;
+  for (j = 0; j < n; j++) h = (h ^ set[j]) * 16777619u;
+  int mask = KILO_DFA_MAX_STATES * 2 - 1;
+  int slot = h & mask;
+  while (d->hash[slot] != -1) {
+    struct dfaState *ds = d->states[d->hash[slot]];
+    if (ds->nset == n && memcmp(ds->set, set, sizeof(int) * n) == 0) return d->hash[slot];
+    slot = (slot + 1) & mask;
+  }
+
+  if (d->nstates == KILO_DFA_MAX_STATES) {
+    dfaFlush(d);
+    return dfaLookup(d, set, n);
+  }
+  struct dfaState *ds = malloc(sizeof(struct dfaState));
+  if (ds == NULL) die("malloc");
+  ds->set = malloc(sizeof(int) * (n ? n : 1));
+  memcpy(ds->set, set, sizeof(int) * n);
+  ds->nset = n;
+  ds->match = 0;
+  ds->endmatch[0] = -1;
+  ds->endmatch[1] = -1;
+  for (j = 0; j < n; j++)
+    if (d->nfa->st[set[j]].type == NFA_MATCH) ds->match = 1;
+  memset(ds->next, -1, sizeof(ds->next));
+  d->states[d->nstates] = ds;
+  d->hash[slot] = d->nstates;
+  return d->nstates++;
+}
+
+void dfaClearMarks(struct dfa *d) {
+  int j;
+  for (j = 0; j < d->nfa->nst; j++) d->mark[j] = 0;
+}
+
+//sort the set, clear the marks left by dfaClosure() and look the state up
+int dfaFinishSet(struct dfa *d, int *set, int n) {
+  dfaClearMarks(d);
+  qsort(set, n, sizeof(int), dfaIntCmp);
+  return dfaLookup(d, set, n);
+}
+
+//start state, bol when the DFA start at the beginning of the text
+int dfaStart(struct dfa *d, int bol) {
+  int n = dfaClosure(d, d->nfa->start, d->buf, 0, bol ? DFA_AT_BOL : 0);
+  return dfaFinishSet(d, d->buf, n);
+}
+
+//true if state s accept when the text end right there. empty when the end is also the start
+int dfaAcceptEnd(struct dfa *d, int s, int empty) {
+  struct dfaState *ds = d->states[s];
+  if (ds->match) return 1;
+  if (ds->endmatch[empty] == -1) {
+    int n = 0, j;
+    for (j = 0; j < ds->nset; j++) {
+      const struct nfaState *st = &d->nfa->st[ds->set[j]];
+      if (st->type == NFA_EOL) n = dfaClosure(d, st->out, d->buf, n, DFA_AT_EOL | (empty ? DFA_AT_BOL : 0));
+    }
+    dfaClearMarks(d);
+    ds->endmatch[empty] = 0;
+    for (j = 0; j < n; j++)
+      if (d->nfa->st[d->buf[j]].type == NFA_MATCH) ds->endmatch[empty] = 1;
+  }
+  return ds->endmatch[empty];
+}
+
+//state reached from state s by reading byte c. computed once, then it is a table lookup
+int dfaStep(struct dfa *d, int s, unsigned char c) {
+  int next = d->states[s]->next[c];
+  if (next >= 0) return next;
+
+  struct dfaState *ds = d->states[s];
+  int n = 0;
+  int j;
+  for (j = 0; j < ds->nset; j++) {
+    const struct nfaState *st = &d->nfa->st[ds->set[j]];
+    if (st->type == NFA_SET && reSetHas(st->set, c)) n = dfaClosure(d, st->out, d->buf, n, 0);
+  }
+  if (d->unanchored) n = dfaClosure(d, d->nfa->start, d->buf, n, 0);
+  int flushed = d->nstates == KILO_DFA_MAX_STATES;
+  next = dfaFinishSet(d, d->buf, n);
+  if (!flushed) d->states[s]->next[c] = next; //s is gone if the cache was flushed
+  return next;
+}
+
+//true when the DFA can't match anymore whatever come next
+int dfaDead(struct dfa *d, int s) {
+  return !d->unanchored && d->states[s]->nset == 0;
+}
+
+//true if text contain a match. d must be built unanchored on re->fwd
+int regexMatchRow(struct regex *re, struct dfa *d, const char *text, int len) {
+  (void)re;
+  int s = dfaStart(d, 1);
+  int j;
+  for (j = 0; j < len; j++) {
+    if (d->states[s]->match) return 1;
+    if (dfaDead(d, s)) return 0;
+    s = dfaStep(d, s, text[j]);
+  }
+  return dfaAcceptEnd(d, s, len == 0);
+}
+
+//the DFAs needed to find where a match start and end, used by the main thread
+struct regexLocator {
+  struct dfa back; //reversed regex run from the end of the row: leftmost start
+  struct dfa extend; //forward, anchored at that start: longest end
+};
+
+struct regexLocator *regexLocatorNew(struct regex *re) {
+  struct regexLocator *rl = malloc(sizeof(struct regexLocator));
+  if (rl == NULL) die("malloc");
+  dfaInit(&rl->back, &re->rev, 1);
+  dfaInit(&rl->extend, &re->fwd, 0);
+  return rl;
+}
+
+void regexLocatorFree(struct regexLocator *rl) {
+  if (rl == NULL) return;
+  dfaFree(&rl->back);
+  dfaFree(&rl->extend);
+  free(rl);
+}
+
+//find the leftmost-longest match in text and store it as [*start, *end). two linear passes, no backtracking
+int regexLocate(struct regex *re, struct regexLocator *rl, const char *text, int len, int *start, int *end) {
+  int s, j;
+  //1. run the reversed regex from the end of the row to the front. every position where it
+  //accept is the start of some match, the last one seen is the leftmost
+  //the reversed regex start at the end of the row, where its ^ (our $) hold
+  (void)re;
+  int b = -1;
+  s = dfaStart(&rl->back, 1);
+  for (j = len; ; j--) {
+    if (j == 0 ? dfaAcceptEnd(&rl->back, s, len == 0) : rl->back.states[s]->match) b = j;
+    if (j == 0 || dfaDead(&rl->back, s)) break;
+    s = dfaStep(&rl->back, s, text[j - 1]);
+  }
+  if (b == -1) return 0;
+
+  //2. from that start, the last accepting position is the longest match
+  int e = -1;
+  s = dfaStart(&rl->extend, b == 0);
+  for (j = b; ; j++) {
+    if (j == len ? dfaAcceptEnd(&rl->extend, s, j == 0) : rl->extend.states[s]->match) e = j;
+    if (j == len || dfaDead(&rl->extend, s)) break;
+    s = dfaStep(&rl->extend, s, text[j]);
+  }
+  if (e == -1) return 0;
+  *start = b;
+  *end = e;
+  return 1;
+}
+
+/*** search engine ***/
+
+void searchCompile(struct searchPattern *pat, const char *query) {
+  pat->s = query;
+  pat->len = strlen(query);
+  int j;
+  for (j = 0; j < 256; j++) pat->skip[j] = pat->len;
+  //how far we can shift when the byte under the last position of the pattern is c
+  for (j = 0; j < pat->len - 1; j++) pat->skip[(unsigned char)query[j]] = pat->len - 1 - j;
+  pat->re = NULL;
+}
+
+#ifdef __SSE2__
+//compare the first and the last byte of the pattern against 16 positions at once and only
+//memcmp() the positions where both match. pat->len must be at least 2
+const char *searchKernelSSE2(const struct searchPattern *pat, const char *h, size_t hlen) {
+  size_t n = pat->len;
+  const __m128i first = _mm_set1_epi8(pat->s[0]);
+  const __m128i last = _mm_set1_epi8(pat->s[n - 1]);
+  size_t i = 0;
+  for (; i + n - 1 + 16 <= hlen; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(h + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(h + i + n - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                    _mm_cmpeq_epi8(bl, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, pat->s + 1, n - 2) == 0) return h + i + bit;
+      mask &= mask - 1; //clear lowest set bit
+    }
+  }
+  if (i + n > hlen) return NULL;
+  if (hlen >= n - 1 + 16) {
+    //less than 16 positions left: redo one block ending exactly at the end of h and drop
+    //the positions that were already checked, so we never read past hlen
+    size_t j = hlen - n + 1 - 16;
+    __m128i bf = _mm_loadu_si128((const __m128i *)(h + j));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(h + j + n - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                    _mm_cmpeq_epi8(bl, last)));
+    mask &= ~0u << (i - j);
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(h + j + bit + 1, pat->s + 1, n - 2) == 0) return h + j + bit;
+      mask &= mask - 1;
+    }
+    return NULL;
+  }
+  //haystack shorter than one block
+  const char *p = h;
+  const char *end = h + hlen - n + 1;
+  while ((p = memchr(p, pat->s[0], end - p)) != NULL) {
+    if (memcmp(p + 1, pat->s + 1, n - 1) == 0) return p;
+    p++;
+  }
+  return NULL;
+}
+
+#ifdef KILO_AVX2
+//the SSE2 kernel with 32 positions per step. the positions left at the end are handed to it
+__attribute__((target("avx2")))
+const char *searchKernelAVX2(const struct searchPattern *pat, const char *h, size_t hlen) {
+  size_t n = pat->len;
+  const __m256i first = _mm256_set1_epi8(pat->s[0]);
+  const __m256i last = _mm256_set1_epi8(pat->s[n - 1]);
+  size_t i = 0;
+  for (; i + n - 1 + 32 <= hlen; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(h + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(h + i + n - 1));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                                                          _mm256_cmpeq_epi8(bl, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, pat->s + 1, n - 2) == 0) return h + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  if (i + n > hlen) return NULL;
+  return searchKernelSSE2(pat, h + i, hlen - i);
+}
+#endif
+#endif
+
+//Boyer-Moore-Horspool, used when there is no SSE2
+const char *searchKernelHorspool(const struct searchPattern *pat, const char *h, size_t hlen) {
+  size_t n = pat->len;
+  size_t i = 0;
+  while (i + n <= hlen) {
+    unsigned char c = h[i + n - 1];
+    if (c == (unsigned char)pat->s[n - 1] && memcmp(h + i, pat->s, n - 1) == 0) return h + i;
+    i += pat->skip[c];
+  }
+  return NULL;
+}
+
+//kernel for patterns of 2 bytes or more, the fastest this CPU can run
+const char *(*searchKernel)(const struct searchPattern *pat, const char *h, size_t hlen);
+
+//pick the kernel once, before any worker start
+void searchInitKernels(void) {
+  searchKernel = searchKernelHorspool;
+#ifdef __SSE2__
+  searchKernel = searchKernelSSE2;
+#ifdef KILO_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) searchKernel = searchKernelAVX2;
+#endif
+#endif
+}
+
+//name of the kernel in use, for the bench
+const char *searchKernelName(void) {
+#ifdef __SSE2__
+#ifdef KILO_AVX2
+  if (searchKernel == searchKernelAVX2) return "avx2";
+#endif
+  if (searchKernel == searchKernelSSE2) return "sse2";
+#endif
+  return "horspool";
+}
+
+//return the first occurrence of the pattern in h[0..hlen), or NULL
+const char *searchMem(const struct searchPattern *pat, const char *h, size_t hlen) {
+  if (pat->len == 0 || (size_t)pat->len > hlen) return NULL;
+  if (pat->len == 1) return memchr(h, pat->s[0], hlen);
+  return searchKernel(pat, h, hlen);
+}
+
+//column (in chars) of the first match in row, or -1
+int searchRow(const struct searchPattern *pat, erow *row) {
+  const char *match = searchMem(pat, row->chars, row->size);
+  return match ? match - row->chars : -1;
+}
+
+//true when row at + 1 start right after row at (and its \n or \r\n) in the file mapping
+int searchRowsContiguous(const struct searchJob *job, erow *row, erow *next) {
+  const char *map = job->map, *mapend = job->map + job->maplen;
+  if (map == NULL || row->chars < map || row->chars >= mapend || next->chars < map || next->chars >= mapend)
+    return 0;
+  char *end = row->chars + row->size;
+  return next->chars == end + 1 || (next->chars == end + 2 && end[0] == '\r');
+}
+
+void rowListAppend(struct rowList *l, int row) {
+  if (l->len == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 64;
+    l->rows = realloc(l->rows, sizeof(int) * l->cap);
+    if (l->rows == NULL) die("realloc");
+  }
+  l->rows[l->len++] = row;
+}
+
+//append every row in [from, to) containing the pattern to out. rows that still sit next to each other
+//in the file mapping are scanned as one block of memory, a match is then mapped back to its row
+//by a search on the chars pointers, and the scan continue from the next row
+void searchScanRows(const struct searchJob *job, int from, int to, struct rowList *out) {
+  const struct searchPattern *pat = &job->pat;
+  int r = from;
+  while (r < to) {
+    //grow a run of rows that are contiguous in the mapping
+    int end = r + 1;
+    erow *last = editorRowAt(r);
+    while (end < to) {
+      erow *next = editorRowAt(end);
+      if (!searchRowsContiguous(job, last, next)) break;
+      last = next;
+      end++;
+    }
+
+    int cur = r;
+    while (cur < end) {
+      const char *start = editorRowAt(cur)->chars;
+      const char *match = searchMem(pat, start, last->chars + last->size - start);
+      if (match == NULL) break;
+      //find the last row of the run that start at or before match. gallop from cur first
+      //since the match is usually a few rows away, then binary search the last step
+      int lo = cur, step = 1;
+      while (lo + step < end && editorRowAt(lo + step)->chars <= match) {
+        lo += step;
+        step *= 2;
       }
+      int hi = lo + step < end ? lo + step - 1 : end - 1;
+      while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (editorRowAt(mid)->chars <= match) lo = mid;
+        else hi = mid - 1;
+      }
+      rowListAppend(out, lo);
+      cur = lo + 1;
     }
-    close(fd);
+    r = end;
+  }
+}
+
+//append every row in [from, to) matching the regex to out. rows are run through the DFA one by one
+void regexScanRows(struct regex *re, struct dfa *d, int from, int to, struct rowList *out) {
+  int r;
+  for (r = from; r < to; r++) {
+    erow *row = editorRowAt(r);
+    if (regexMatchRow(re, d, row->chars, row->size)) rowListAppend(out, r);
+  }
+}
+
+//append the candidate rows that contain the pattern to out. used when the query grew,
+//every row that contain the new query also contained the old one
+void searchNarrowRows(const struct searchPattern *pat, const int *cand, int n, struct rowList *out) {
+  int j;
+  for (j = 0; j < n; j++)
+    if (searchRow(pat, editorRowAt(cand[j])) != -1) rowListAppend(out, cand[j]);
+}
+
+//worker thread: wait for a job, scan blocks of it until there is nothing left, repeat.
+//workers only read chars and size of the rows. the buffer can't change while the search prompt
+//is open, the main thread only touch render, hl and flags (and no save finish, see editorPrompt()).
+//the main thread wait for the workers before the job is dropped
+void *searchWorker(void *arg) {
+  (void)arg;
+  struct findState *f = &E.find;
+  unsigned seen = 0;
+  while (1) {
+    pthread_mutex_lock(&f->lock);
+    while (f->jobgen == seen) pthread_cond_wait(&f->wake, &f->lock);
+    seen = f->jobgen;
+    struct searchJob *job = f->job;
+    pthread_mutex_unlock(&f->lock);
+
+    //every worker build its own lazy DFA, the compiled regex itself is shared and read-only
+    struct dfa d;
+    if (job->pat.re) dfaInit(&d, &job->pat.re->fwd, 1);
+
+    int b;
+    while (!atomic_load(&job->cancel) && (b = atomic_fetch_add(&job->next, 1)) < job->nblocks) {
+      struct searchBlock *blk = &job->blocks[b];
+      int from = b * KILO_SEARCH_BLOCK;
+      int to = from + KILO_SEARCH_BLOCK < job->total ? from + KILO_SEARCH_BLOCK : job->total;
+      if (job->pat.re) regexScanRows(job->pat.re, &d, from, to, &blk->found);
+      else if (job->cand) searchNarrowRows(&job->pat, &job->cand[from], to - from, &blk->found);
+      else searchScanRows(job, from, to, &blk->found);
+      atomic_fetch_add(&job->found, blk->found.len);
+      atomic_store(&blk->done, 1);
+      atomic_fetch_add(&job->finished, 1);
+      pthread_mutex_lock(&f->lock);
+      pthread_cond_broadcast(&f->progress);
+      pthread_mutex_unlock(&f->lock);
+      editorWake(); //let the main loop show the new matches
+    }
+
+    if (job->pat.re) dfaFree(&d);
+    pthread_mutex_lock(&f->lock);
+    job->running--;
+    pthread_cond_broadcast(&f->progress);
+    pthread_mutex_unlock(&f->lock);
+  }
+  return NULL;
+}
+
+//start the thread pool, one worker per CPU
+void searchStartThreads(void) {
+  struct findState *f = &E.find;
+  if (f->threads) return;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  f->nthreads = ncpu < 1 ? 1 : ncpu > KILO_SEARCH_MAX_THREADS ? KILO_SEARCH_MAX_THREADS : ncpu;
+  f->threads = malloc(sizeof(pthread_t) * f->nthreads);
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->wake, NULL);
+  pthread_cond_init(&f->progress, NULL);
+  int j;
+  for (j = 0; j < f->nthreads; j++) {
+    if (pthread_create(&f->threads[j], NULL, searchWorker, NULL) != 0) die("pthread_create");
+    pthread_detach(f->threads[j]);
+  }
+}
+
+//stop the running job (if any), wait until no worker use it anymore and free it
+void searchCancelJob(void) {
+  struct findState *f = &E.find;
+  struct searchJob *job = f->job;
+  if (job == NULL) return;
+  atomic_store(&job->cancel, 1);
+  pthread_mutex_lock(&f->lock);
+  while (job->running > 0) pthread_cond_wait(&f->progress, &f->lock);
+  f->job = NULL;
+  pthread_mutex_unlock(&f->lock);
+
+  int b;
+  for (b = 0; b < job->nblocks; b++) free(job->blocks[b].found.rows);
+  free(job->blocks);
+  free(job->cand);
+  free(job->query);
+  free(job);
+}
+
+//copy the blocks that finished, in order, into the match list. return 1 if something changed
+int editorSearchPoll(void) {
+  struct findState *f = &E.find;
+  struct searchJob *job = f->job;
+  if (job == NULL || f->complete) return 0;
+  int changed = 0;
+  while (f->merged < job->nblocks && atomic_load(&job->blocks[f->merged].done)) {
+    struct rowList *found = &job->blocks[f->merged].found;
+    int j;
+    for (j = 0; j < found->len; j++) rowListAppend(&f->matches, found->rows[j]);
+    f->merged++;
+    changed = 1;
+  }
+  if (f->merged == job->nblocks) {
+    f->complete = 1;
+    changed = 1;
+  }
+  return changed;
+}
+
+//block until the job finished or ms milliseconds passed (-1 wait for ever)
+void editorSearchWait(int ms) {
+  struct findState *f = &E.find;
+  struct searchJob *job = f->job;
+  if (job == NULL) return;
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += (long)(ms < 0 ? 0 : ms) * 1000000;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000;
+  deadline.tv_nsec %= 1000000000;
+
+  pthread_mutex_lock(&f->lock);
+  while (atomic_load(&job->finished) < job->nblocks && job->running > 0) {
+    if (ms < 0) pthread_cond_wait(&f->progress, &f->lock);
+    else if (pthread_cond_timedwait(&f->progress, &f->lock, &deadline) != 0) break;
+  }
+  pthread_mutex_unlock(&f->lock);
+  editorSearchPoll();
+}
+
+//bring the match list up to date with query. the scan run on the worker threads,
+//rows come in through editorSearchPoll(). small buffers are usually done before this return
+void editorSearchUpdate(const char *query) {
+  struct findState *f = &E.find;
+  if (f->query && strcmp(f->query, query) == 0) return;
+
+  //when the query grew and the old list is complete, only rows that matched before can match now.
+  //that isn't true for a regex (a -> a|b), regex searches always scan everything
+  int narrow = !f->regex && f->query && f->query[0] && f->complete &&
+               strncmp(query, f->query, strlen(f->query)) == 0;
+  //rows that came from a pipe or a followed file after that scan are checked as candidates too
+  int scanned = f->job ? f->job->numrows : 0;
+  if (scanned > E.numrows) narrow = 0;
+  searchCancelJob(); //the workers may be using the old regex
+  free(f->query);
+  f->query = strdup(query);
+  regexLocatorFree(f->locator);
+  regexFree(f->re);
+  f->locator = NULL;
+  f->re = NULL;
+
+  struct searchJob *job = calloc(1, sizeof(struct searchJob));
+  if (job == NULL) die("calloc");
+  job->query = strdup(query);
+  job->map = E.map;
+  job->maplen = E.maplen;
+  job->numrows = E.numrows;
+  searchCompile(&job->pat, job->query);
+  if (f->regex) {
+    //compiled once per query, each worker then build its own DFA from it
+    f->re = query[0] ? regexCompile(query) : NULL;
+    if (f->re) f->locator = regexLocatorNew(f->re);
+    job->pat.re = f->re;
+    job->pat.len = f->re ? 1 : 0; //an invalid regex match nothing
   }
+  if (narrow) {
+    //the old list becomes the candidates, they all come before the new rows
+    int r;
+    for (r = scanned; r < E.numrows; r++) rowListAppend(&f->matches, r);
+    job->cand = f->matches.rows;
+    job->total = f->matches.len;
+    memset(&f->matches, 0, sizeof(f->matches));
+  } else {
+    job->total = E.numrows;
+  }
+  f->matches.len = 0;
+  f->merged = 0;
+  f->complete = 0;
+  if (job->pat.len == 0) job->total = 0;
+  job->nblocks = (job->total + KILO_SEARCH_BLOCK - 1) / KILO_SEARCH_BLOCK;
+  job->blocks = calloc(job->nblocks ? job->nblocks : 1, sizeof(struct searchBlock));
+  if (job->blocks == NULL) die("calloc");
+
+  searchStartThreads();
+  pthread_mutex_lock(&f->lock);
+  job->running = f->nthreads;
+  f->job = job;
+  f->jobgen++;
+  pthread_cond_broadcast(&f->wake);
+  pthread_mutex_unlock(&f->lock);
+
+  editorSearchWait(20); //a short wait so small files feel synchronous
+}
+
+//true while workers may still read the rows
+int editorSearchBusy(void) {
+  return E.find.job != NULL && !E.find.complete;
+}
 
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+//forget the match list when the search prompt close
+void editorSearchReset(void) {
+  struct findState *f = &E.find;
+  searchCancelJob();
+  free(f->query);
+  f->query = NULL;
+  regexLocatorFree(f->locator);
+  regexFree(f->re);
+  f->locator = NULL;
+  f->re = NULL;
+  f->matches.len = 0;
+  f->merged = 0;
+  f->complete = 0;
+  f->current = -1;
 }
 
 /*** find ***/
 
 //find the next matching word. also set cursor position to their initial value if cancel the search
 void editorFindCallback(char *query, int key) {
-  static int last_match = -1;
-  static int direction = 1;
-
   static int saved_hl_line;
+  static int saved_hl_start; //the row was highlighted again (by the worker) if this changed
   static char *saved_hl = NULL;
+  struct findState *f = &E.find;
 
   //use to restore default text color after search
   if (saved_hl) {
-    memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
+    erow *row = editorRowAt(saved_hl_line);
+    if (row->hl_start == saved_hl_start) memcpy(row->hl, saved_hl, row->rsize);
     free(saved_hl);
     saved_hl = NULL;
   }
 
   if (key == '\r' || key == '\x1b') {
-    last_match = -1;
-    direction = 1;
+    editorSearchReset();
     return;
+  }
+
+  int step = 0;
+  if (key == KEY_WAKEUP) {
+    editorSearchPoll(); //more blocks finished, the list just grew
   } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-    direction = 1;
+    step = 1;
   } else if (key == ARROW_LEFT || key == ARROW_UP) {
-    direction = -1;
+    step = -1;
   } else {
-    last_match = -1;
-    direction = 1;
-  }
-
-  if (last_match == -1) direction = 1;
-  int current = last_match;
-  int i;
-  for (i = 0; i < E.numrows; i++) {
-    current += direction;
-    if (current == -1) current = E.numrows - 1;
-    else if (current == E.numrows) current = 0;
-
-    erow *row = &E.row[current];
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
-      E.rowoff = E.numrows;
-
-      saved_hl_line = current;
-      saved_hl = malloc(row->rsize);
-      memcpy(saved_hl, row->hl, row->rsize);
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-      break;
-    }
+    editorSearchUpdate(query);
+    f->current = -1;
+  }
+
+  struct rowList *m = &f->matches;
+  if (m->len == 0) return;
+  //first match after the query changed, otherwise move through the list. it only wrap
+  //around once the scan is complete, until then the end of the list isn't the end of the file
+  int moved = 1;
+  if (f->current == -1) {
+    f->current = 0;
+  } else if (step == 1) {
+    f->current = f->current + 1 < m->len ? f->current + 1 : f->complete ? 0 : f->current;
+  } else if (step == -1) {
+    f->current = f->current > 0 ? f->current - 1 : f->complete ? m->len - 1 : 0;
+  } else {
+    moved = 0; //only new results came in, keep the cursor where it is
+  }
+
+  int filerow = m->rows[f->current];
+  erow *row = editorRowAt(filerow);
+  int cx, cxend;
+  if (f->re) {
+    if (!regexLocate(f->re, f->locator, row->chars, row->size, &cx, &cxend)) return;
+  } else {
+    struct searchPattern pat;
+    searchCompile(&pat, query);
+    cx = searchRow(&pat, row);
+    if (cx == -1) return;
+    cxend = cx + pat.len;
   }
+
+  if (moved) {
+    E.cy = filerow;
+    E.cx = cx;
+    E.rowoff = E.numrows;
+  }
+
+  editorRowPrepare(filerow);
+  //a regex match can contain tabs, so convert both ends to render positions
+  int rx = editorRowCxtoRx(row, cx);
+  int rxend = editorRowCxtoRx(row, cxend);
+  saved_hl_line = filerow;
+  saved_hl_start = row->hl_start;
+  saved_hl = malloc(row->rsize);
+  memcpy(saved_hl, row->hl, row->rsize);
+  memset(&row->hl[rx], HL_MATCH, rxend - rx);
+}
+
+//Ctrl-G: jump to a line number, shown in the middle of the screen
+void editorGoToLine(void) {
+  char *input = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+  if (input == NULL) return;
+  long line = strtol(input, NULL, 10);
+  free(input);
+  if (line < 1) line = 1;
+  if (line > E.numrows) line = E.numrows ? E.numrows : 1;
+  E.cy = line - 1;
+  E.cx = 0;
+  E.rowoff = E.cy > E.screenrows / 2 ? E.cy - E.screenrows / 2 : 0;
 }
 
-//search funciotn, also restore cursor position when cancelling search
-void editorFind(void) {
+//search funciotn, also restore cursor position when cancelling search. regex select Ctrl-R mode
+void editorFind(int regex) {
   int saved_cx = E.cx;
   int saved_cy = E.cy;
   int saved_coloff = E.coloff;
   int saved_rowoff = E.rowoff;
 
-  char *query = editorPrompt("Search: %s (ESC/Arrows/Enter)", 
+  E.find.regex = regex;
+  char *query = editorPrompt(regex ? "Regex: %s (ESC/Arrows/Enter)" : "Search: %s (ESC/Arrows/Enter)",
                              editorFindCallback);
+  E.find.regex = 0;
 
   if (query) {
     free(query);
@@ -562,63 +4101,73 @@ void editorFind(void) {
     E.cy = saved_cy;
     E.coloff = saved_coloff;
     E.rowoff = saved_rowoff;
-  }
-}
-
-/*** append buffer ***/
-//create dynamic string
-struct abuf {
-  char *b;
-  int len;
-};
-
-#define ABUF_INIT {NULL, 0}
+  }
+}
 
+/*** append buffer ***/
 // this is one of core function of Kilo. instead of write() every screenrefresh,
 // we create big buffer and and write() only once.
-// append s to abuf and then use realloc() to re-allocate memory to hold new string.
+// append s to abuf, the buffer only grow (by doubling) when it is full.
 void abAppend(struct abuf *ab, const char *s, int len) {
-  /*
-   * Grow (or create) the buffer so it can hold:
-   *   - existing data (ab->len)
-   *   - new data we want to append (len)
-   *
-   * realloc():
-   *   - works like malloc() if ab->b == NULL
-   *   - preserves old data
-   */
-  char *new = realloc(ab->b, ab->len + len);
+  if (len == 0) return; //an empty undo record, ab->b may still be NULL
+  if (ab->len + len > ab->cap) {
+    /*
+     * Grow (or create) the buffer so it can hold:
+     *   - existing data (ab->len)
+     *   - new data we want to append (len)
+     *
+     * doubling the capacity means a buffer that is reused for every frame
+     * stop calling realloc() after the first few frames
+     *
+     * realloc():
+     *   - works like malloc() if ab->b == NULL
+     *   - preserves old data
+     */
+    int newcap = ab->cap ? ab->cap * 2 : 64;
+    while (newcap < ab->len + len) newcap *= 2;
+    char *new = realloc(ab->b, newcap);
+
+    /*
+     * If memory allocation failed, do nothing.
+     * Kilo chooses to fail silently instead of crashing.
+     */
+    if (new == NULL) return;
+
+    /*
+     * Update the buffer pointer.
+     * (realloc may move memory to a new location)
+     */
+    ab->b = new;
+    ab->cap = newcap;
+  }
 
-  /*
-   * If memory allocation failed, do nothing.
-   * Kilo chooses to fail silently instead of crashing.
-   */
-  if (new == NULL) return;
- 
-  //copy the string s ,and update the pointer and length to abuf new values
+  //copy the string s ,and update the length to abuf new values
   /*
    * Copy the new bytes into the buffer
    * starting exactly at the end of existing data.
    *
-   * new_buf + ab->len
+   * ab->b + ab->len
    * └── append position
    */
-  memcpy(&new[ab->len], s, len);
-
-  /*
-   * Update the buffer pointer.
-   * (realloc may move memory to a new location)
-   */
-  ab->b = new;
+  memcpy(&ab->b[ab->len], s, len);
 
   /*
    * Update length to include the newly appended data.
    */
   ab->len += len;
 }
+
+//empty the buffer but keep its memory for the next frame
+void abReset(struct abuf *ab) {
+  ab->len = 0;
+}
+
 // deallocates the dynamic memory used by an abuf
 void abFree(struct abuf *ab) {
   free(ab->b);
+  ab->b = NULL;
+  ab->len = 0;
+  ab->cap = 0;
 }
 
 /*** output ***/
@@ -627,7 +4176,7 @@ void abFree(struct abuf *ab) {
 void editorScroll(void) {
   E.rx = E.cx;
   if (E.cy < E.numrows) {
-    E.rx = editorRowCxtoRx(&E.row[E.cy], E.cx);
+    E.rx = editorRowCxtoRx(editorRowAt(E.cy), E.cx);
   }
 
   if (E.cy < E.rowoff) {
@@ -644,10 +4193,22 @@ void editorScroll(void) {
   }
 }
 
-// draw ~ in the begining of the line by the size of window
-void editorDrawRows(struct abuf *ab) {
+//render the rows on screen plus a margin around them, so rows that scroll in are usually ready
+void editorPrepareVisibleRows(void) {
+  int first = E.rowoff - KILO_PREFETCH_ROWS;
+  int last = E.rowoff + E.screenrows + KILO_PREFETCH_ROWS;
+  if (first < 0) first = 0;
+  if (last > E.numrows) last = E.numrows;
+  int j;
+  for (j = first; j < last; j++) editorRowPrepare(j);
+}
+
+// draw ~ in the begining of the line by the size of window. every screen row goes to its own buffer in lines
+void editorDrawRows(struct abuf *lines) {
+  editorPrepareVisibleRows();
   int y;
   for (y = 0; y < E.screenrows; y++) {
+    struct abuf *ab = &lines[y];
     int filerow = y + E.rowoff;
     if (filerow >= E.numrows) {
       //if text buffer is empty display welcome message third way down of the scrren
@@ -669,48 +4230,66 @@ void editorDrawRows(struct abuf *ab) {
       // draw ~ at last line
       }
     } else {
-      int len = E.row[filerow].rsize - E.coloff;
+      erow *row = editorRowAt(filerow);
+      int len = row->rsize - E.coloff;
       if (len < 0) len = 0;
       if (len > E.screencols) len = E.screencols;
-      char *c = &E.row[filerow].render[E.coloff];
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
+      char *c = &row->render[E.coloff];
+      unsigned char *hl = &row->hl[E.coloff];
       int current_color = -1;
-      int j;
-      for (j = 0; j < len; j++) {
-        if (hl[j] == HL_NORMAL) {
-          if (current_color != -1) {
-          abAppend(ab, "\x1b[39m", 5);
-          current_color = -1;
+      int j = 0;
+      //copy the row one run of same color characters at a time instead of byte by byte
+      while (j < len) {
+        int color = hl[j] == HL_NORMAL ? -1 : editorSyntaxToColor(hl[j]);
+        int start = j;
+        while (j < len && hl[j] == hl[start]) j++;
+
+        if (color != current_color) {
+          if (color == -1) {
+            abAppend(ab, "\x1b[39m", 5);
+          } else {
+            //colors are always two digits (30-37), build ESC[<color>m without going through snprintf()
+            char buf[5] = {'\x1b', '[', '0' + color / 10, '0' + color % 10, 'm'};
+            abAppend(ab, buf, 5);
           }
-          abAppend(ab, &c[j], 1);
-        } else {
-          int color = editorSyntaxToColor(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            char buf[16];
-            int clean = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            abAppend(ab, buf, clean);
-          }
-          abAppend(ab, &c[j], 1);
+          current_color = color;
         }
+        abAppend(ab, &c[start], j - start);
       }
       abAppend(ab, "\x1b[39m", 5);
     }
     //only clear one line at a time as it redrew them
     //K command(Erase in Line) O is defualt argument
     abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
   }
 }
 
 void editorDrawStatusBar(struct abuf *ab) {
   abAppend(ab, "\x1b[7m", 4); //invert color to make it standout
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
+  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s%s", 
     E.filename ? E.filename : "[No Name]", E.numrows, //use snprintf() to set the amount of line and file name 
-    E.dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-    E.cy + 1, E.numrows);
+    E.dirty ? "(modified)" : "", E.follow.fd == -1 ? "" : E.follow.stream ? "(reading...)" : "(following)");
+  int rlen;
+  struct findState *f = &E.find;
+  if (f->regex && f->query && f->query[0] && f->re == NULL) {
+    rlen = snprintf(rstatus, sizeof(rstatus), "bad regex");
+  } else if (f->query && f->query[0]) {
+    //while the workers are still scanning, N count matches of every finished block
+    int total = f->complete ? f->matches.len : (f->job ? atomic_load(&f->job->found) : 0);
+    rlen = snprintf(rstatus, sizeof(rstatus), "match %d of %d%s",
+      f->current + 1, total, f->complete ? "" : " (scanning...)");
+  } else if (E.lat.overlay) {
+    //key to paint of the last key, and over the session
+    struct histogram *h = &E.lat.phase[LAT_TOTAL];
+    //and the bytes sent for the previous frame, to keep an eye on the terminal traffic
+    rlen = snprintf(rstatus, sizeof(rstatus), "key %.2fms p50 %.2f p99 %.2f max %.1f | draw p99 %.2f %dB",
+      E.lat.last / 1e6, histQuantile(h, 0.5) / 1e6, histQuantile(h, 0.99) / 1e6, h->max / 1e6,
+      histQuantile(&E.lat.phase[LAT_DRAW], 0.99) / 1e6, E.framebytes);
+  } else {
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+      E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
+  }
   if (len > E.screencols) len = E.screencols;
   abAppend(ab, status, len);
   while (len < E.screencols) {
@@ -723,7 +4302,6 @@ void editorDrawStatusBar(struct abuf *ab) {
     }
   }
   abAppend(ab, "\x1b[m", 3); //ESC sequences for text format. 0 clear arttribute
-  abAppend(ab, "\r\n", 2);
 }
 
 //drawmessage bar at bottom of the screen
@@ -731,33 +4309,82 @@ void editorDrawMessageBar(struct abuf *ab) {
   abAppend(ab, "\x1b[K", 3);
   int msglen = strlen(E.statusmsg);
   if (msglen > E.screencols) msglen = E.screencols;
-  if (msglen && time(NULL) - E.statusmsg_time < 5)
+  if (msglen && time(NULL) - E.statusmsg_time < KILO_MESSAGE_SECONDS)
     abAppend(ab, E.statusmsg, msglen);
 }
 
+//forget what is on the terminal so the next refresh redraw every line (Ctrl-L, resize)
+void editorInvalidateScreen(void) {
+  E.screenvalid = 0;
+}
+
+//(re)allocate the front and back line buffers when the number of screen lines change
+void editorResizeScreen(int nlines) {
+  if (nlines == E.screenlines) return;
+  int y;
+  for (y = 0; y < E.screenlines; y++) {
+    abFree(&E.screen[y]);
+    abFree(&E.backscreen[y]);
+  }
+  free(E.screen);
+  free(E.backscreen);
+  E.screen = calloc(nlines, sizeof(struct abuf));
+  E.backscreen = calloc(nlines, sizeof(struct abuf));
+  if (E.screen == NULL || E.backscreen == NULL) die("calloc");
+  E.screenlines = nlines;
+  E.screenvalid = 0;
+}
+
+//draw the whole frame into one buffer per line, then only send the lines that differ
+//from what the terminal already show. typing a character usually resend one text line and the status bar.
+//all buffers live across frames, so after the first few frames drawing doesn't allocate
 void editorRefreshScreen(void) {
+  long long t = editorLatencyPhase(LAT_EDIT, E.lat.key);
   editorScroll();
-  //initialize new abuf called ab
-  struct abuf ab = ABUF_INIT;
-  //append every thing to buffer
-  //also hide cursor when repainting, prevent potential flickering problem
-  abAppend(&ab, "\x1b[?25l", 6);
-  abAppend(&ab, "\x1b[H", 3);
+  t = editorLatencyPhase(LAT_SCROLL, t);
+  editorResizeScreen(E.screenrows + 2); //text rows + status bar + message bar
+  struct abuf *lines = E.backscreen;
+  int y;
+  for (y = 0; y < E.screenlines; y++) abReset(&lines[y]);
 
-  editorDrawRows(&ab);
-  editorDrawStatusBar(&ab);
-  editorDrawMessageBar(&ab);
+  editorDrawRows(lines);
+  editorDrawStatusBar(&lines[E.screenrows]);
+  editorDrawMessageBar(&lines[E.screenrows + 1]);
+
+  struct abuf *ab = &E.frame;
+  abReset(ab);
+  //hide cursor when repainting, prevent potential flickering problem
+  abAppend(ab, "\x1b[?25l", 6);
 
   char buf[32];
+  for (y = 0; y < E.screenlines; y++) {
+    if (E.screenvalid && E.screen[y].len == lines[y].len &&
+        (lines[y].len == 0 || memcmp(E.screen[y].b, lines[y].b, lines[y].len) == 0))
+      continue; //the terminal already show this line
+    //move to the start of the changed line and rewrite it, every line end with ESC[K so the old tail is erased
+    int clen = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abAppend(ab, buf, clen);
+    abAppend(ab, lines[y].b, lines[y].len);
+  }
+
   //set cursor position
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, 
-                                            (E.rx - E.coloff) + 1);
-  abAppend(&ab, buf, strlen(buf));
+  int clen = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, 
+                                                       (E.rx - E.coloff) + 1);
+  abAppend(ab, buf, clen);
 
-  abAppend(&ab, "\x1b[?25h", 6);
+  abAppend(ab, "\x1b[?25h", 6);
+  t = editorLatencyPhase(LAT_DRAW, t);
   //write only once
-  write(STDOUT_FILENO, ab.b, ab.len);
-  abFree(&ab);
+  if (E.headless) abAppend(&E.capture, ab->b, ab->len);
+  else write(STDOUT_FILENO, ab->b, ab->len);
+  E.framebytes = ab->len;
+  editorLatencyPhase(LAT_WRITE, t);
+  editorLatencyPainted();
+
+  //this frame is now what the terminal show, the old front buffers are reused for the next one
+  E.backscreen = E.screen;
+  E.screen = lines;
+  E.screenvalid = 1;
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -780,6 +4407,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
   buf[0] = '\0';
 
   while (1) {
+    if (!editorSearchBusy()) editorSavePoll(); //a finished save clear ROW_SHARED on rows the workers read
     editorSetStatusMessage(prompt, buf);
     editorRefreshScreen();
 
@@ -797,6 +4425,19 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
       if (callback) callback(buf, c);
         return buf;
       }
+    } else if (c == KEY_PASTE) {
+      //only the first line of the paste, control characters dropped
+      int j;
+      for (j = 0; j < E.paste.len && E.paste.b[j] != '\n'; j++) {
+        if (iscntrl((unsigned char)E.paste.b[j])) continue;
+        if (buflen == bufsize - 1) {
+          bufsize *= 2;
+          buf = realloc(buf, bufsize);
+        }
+        buf[buflen++] = E.paste.b[j];
+      }
+      buf[buflen] = '\0';
+      abFree(&E.paste);
     } else if (!iscntrl(c) && c < 128) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
@@ -812,7 +4453,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
 //cursor movement + out of bound prevention
 void editorMoveCursor(int key) {
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
 
   switch (key)  {
     case ARROW_LEFT:
@@ -820,7 +4461,7 @@ void editorMoveCursor(int key) {
         E.cx--;
       } else if (E.cy > 0) {
         E.cy--;
-        E.cx = E.row[E.cy].size; //if user press <- at the begining of line, move cursor to the end of previos line
+        E.cx = editorRowAt(E.cy)->size; //if user press <- at the begining of line, move cursor to the end of previos line
       }
       break;
 
@@ -846,7 +4487,7 @@ void editorMoveCursor(int key) {
   }
 
   //prevent out of bound row access, invalid column position, and cursor always stay on valid text 
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
   int rowlen = row ? row->size : 0;
   if (E.cx > rowlen) { //check if curosr x position out of text
     E.cx = rowlen; //if so, set cursor x position to the end of text
@@ -864,6 +4505,7 @@ void editorProcessKeypress(void) {
       break;
 
     case CTRL_KEY('q'):
+      editorSaveWait(); //don't leave a half written temporary file behind
       if (E.dirty && quit_times > 0) {
         editorSetStatusMessage("WARNING!!! File has unsaved changes. "
           "Press Ctrl-Q %d more times to quit.", quit_times);
@@ -879,6 +4521,14 @@ void editorProcessKeypress(void) {
       editorSave();
       break;
 
+    case CTRL_KEY('z'):
+      editorUndo();
+      break;
+
+    case CTRL_KEY('y'):
+      editorRedo();
+      break;
+
     //PAGE_UP and PAGE_DOWN to the top and bottom of the screen, while HOME_KEY and END_KEY move cursor left and right edge of screen
     case HOME_KEY:
       E.cx = 0;
@@ -886,11 +4536,23 @@ void editorProcessKeypress(void) {
 
     case END_KEY: //bring to the end of line, if no current line E.cx = 0
       if (E.cy < E.numrows)
-        E.cx = E.row[E.cy].size;
+        E.cx = editorRowAt(E.cy)->size;
       break;
 
     case CTRL_KEY('f'):
-      editorFind();
+      editorFind(0);
+      break;
+
+    case CTRL_KEY('r'): //same as Ctrl-F but the query is a regex
+      editorFind(1);
+      break;
+
+    case CTRL_KEY('g'):
+      editorGoToLine();
+      break;
+
+    case CTRL_KEY('t'): //latency numbers in the status bar
+      E.lat.overlay = !E.lat.overlay;
       break;
 
     case BACKSPACE:
@@ -923,7 +4585,18 @@ void editorProcessKeypress(void) {
       editorMoveCursor(c);
       break;
 
-    case CTRL_KEY('l'):
+    case KEY_WAKEUP: //the main loop refresh the screen right after this
+      break;
+
+    case KEY_PASTE:
+      editorInsertText(E.paste.b, E.paste.len);
+      abFree(&E.paste); //a big paste shouldn't stay around
+      break;
+
+    case CTRL_KEY('l'): //redraw the whole screen
+      editorInvalidateScreen();
+      break;
+
     case '\x1b':
       break;
 
@@ -935,6 +4608,189 @@ void editorProcessKeypress(void) {
   quit_times = KILO_QUIT_TIMES;
 }
 
+/*** script ***/
+
+//kilo --script edits.txt [file|-] run edit commands on the buffer without a terminal, for
+//pipelines (- read the buffer from stdin). nothing is drawn and rows stay mapped until they are edited. one command per line:
+//  goto N             cursor to the start of line N
+//  find TEXT          cursor to the next TEXT after it, an error if there is none
+//  replace /OLD/NEW/  every OLD in the buffer with NEW, any char can be the separator (like sed)
+//  insert TEXT        TEXT as new lines before the cursor line, \n \t and \\ are unescaped
+//  delete-line [N]    N lines (1 by default) from the cursor line
+//  save [FILE|-]      write the buffer to FILE, the file it came from, or - for stdout
+//blank lines and lines starting with # are skipped. a script without save writes to stdout
+
+//undo the \n, \t and \\ escapes of s in place, return the new length
+int editorScriptUnescape(char *s) {
+  char *r = s, *w = s;
+  while (*r) {
+    if (r[0] == '\\' && (r[1] == 'n' || r[1] == 't' || r[1] == '\\')) {
+      *w++ = r[1] == 'n' ? '\n' : r[1] == 't' ? '\t' : '\\';
+      r += 2;
+    } else {
+      *w++ = *r++;
+    }
+  }
+  *w = '\0';
+  return w - s;
+}
+
+//cursor to the first match of text at or after the cursor. return 0 if there is none
+int editorScriptFind(const char *text) {
+  struct searchPattern pat;
+  searchCompile(&pat, text);
+  //a match under the cursor counts, unless it's the one the same find
+  //just landed on, then a repeated find moves on to the next one
+  static char *last = NULL;
+  static int lasty = -1, lastx = -1;
+  int again = last && strcmp(last, text) == 0 && E.cy == lasty && E.cx == lastx;
+  free(last);
+  last = strdup(text);
+  lasty = lastx = -1;
+  int y, x = again ? E.cx + 1 : E.cx;
+  for (y = E.cy; y < E.numrows; y++, x = 0) {
+    erow *row = editorRowAt(y);
+    if (x > row->size) continue;
+    const char *m = searchMem(&pat, row->chars + x, row->size - x);
+    if (m) {
+      E.cy = lasty = y;
+      E.cx = lastx = m - row->chars;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//replace every old with new. rows without a match aren't touched (mapped rows stay mapped).
+//return the number of replacements
+long long editorScriptReplace(const char *old, const char *new) {
+  struct searchPattern pat;
+  searchCompile(&pat, old);
+  int newlen = strlen(new);
+  struct abuf ab = ABUF_INIT;
+  long long count = 0;
+  int y;
+  for (y = 0; y < E.numrows; y++) {
+    erow *row = editorRowAt(y);
+    const char *p = row->chars, *end = row->chars + row->size;
+    const char *m = searchMem(&pat, p, end - p);
+    if (m == NULL) continue;
+    abReset(&ab);
+    do {
+      abAppend(&ab, p, m - p);
+      abAppend(&ab, new, newlen);
+      p = m + pat.len;
+      count++;
+    } while ((m = searchMem(&pat, p, end - p)) != NULL);
+    abAppend(&ab, p, end - p);
+    editorRowSetChars(row, ab.b ? ab.b : "", ab.len);
+  }
+  abFree(&ab);
+  if (E.cy < E.numrows && E.cx > editorRowAt(E.cy)->size) E.cx = editorRowAt(E.cy)->size;
+  return count;
+}
+
+//write the buffer to name, or stdout for -. return 0 or the errno of the failure
+int editorScriptSave(const char *name) {
+  if (strcmp(name, "-") == 0)
+    return editorWriteRows(STDOUT_FILENO, E.numrows, editorRowSourceBuffer, NULL, NULL) == -1 ? errno : 0;
+  char *tmp, *target;
+  int fd = editorSaveOpenTemp(name, &tmp, &target);
+  if (fd == -1) return errno;
+  long long len = editorWriteRows(fd, E.numrows, editorRowSourceBuffer, NULL, NULL);
+  int err = editorSaveFinish(fd, tmp, target, len);
+  free(tmp);
+  free(target);
+  return err;
+}
+
+//run the commands of script on the buffer. return the exit status, errors go to stderr
+int editorScript(const char *script) {
+  FILE *fp = fopen(script, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "kilo: %s: %s\n", script, strerror(errno));
+    return 1;
+  }
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  int lineno = 0, saved = 0, status = 0;
+  while (status == 0 && (linelen = getline(&line, &linecap, fp)) != -1) {
+    lineno++;
+    while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) line[--linelen] = '\0';
+    char *cmd = line;
+    while (*cmd == ' ' || *cmd == '\t') cmd++;
+    if (*cmd == '\0' || *cmd == '#') continue;
+    char *arg = cmd + strcspn(cmd, " \t");
+    if (*arg) *arg++ = '\0';
+    const char *err = NULL;
+
+    if (strcmp(cmd, "goto") == 0) {
+      long n = strtol(arg, NULL, 10);
+      if (n < 1 || n > E.numrows) err = "no such line";
+      else {
+        E.cy = n - 1;
+        E.cx = 0;
+      }
+    } else if (strcmp(cmd, "find") == 0) {
+      editorScriptUnescape(arg);
+      if (*arg == '\0') err = "find needs some text";
+      else if (!editorScriptFind(arg)) err = "not found";
+    } else if (strcmp(cmd, "replace") == 0) {
+      //split /old/new/ on its first char
+      char sep = *arg, *old = arg + 1, *new = sep ? strchr(old, sep) : NULL;
+      char *close = new ? strchr(new + 1, sep) : NULL;
+      if (close == NULL) err = "replace wants /old/new/";
+      else {
+        *new++ = '\0';
+        *close = '\0';
+        editorScriptUnescape(old);
+        editorScriptUnescape(new);
+        if (*old == '\0') err = "nothing to replace";
+        else editorScriptReplace(old, new);
+      }
+    } else if (strcmp(cmd, "insert") == 0) {
+      int len = editorScriptUnescape(arg);
+      char *p = arg, *end = arg + len;
+      while (1) {
+        char *nl = memchr(p, '\n', end - p);
+        editorInsetRow(E.cy++, p, (nl ? nl : end) - p);
+        if (nl == NULL) break;
+        p = nl + 1;
+      }
+      E.cx = 0;
+    } else if (strcmp(cmd, "delete-line") == 0) {
+      long n = *arg ? strtol(arg, NULL, 10) : 1;
+      while (n-- > 0 && E.cy < E.numrows) editorDelRow(E.cy);
+      E.cx = 0;
+    } else if (strcmp(cmd, "save") == 0) {
+      const char *name = *arg ? arg : E.filename;
+      int e = name ? editorScriptSave(name) : EINVAL;
+      if (e) {
+        fprintf(stderr, "%s:%d: can't save %s: %s\n", script, lineno, name ? name : "[No Name]", strerror(e));
+        status = 1;
+      }
+      saved = 1;
+    } else {
+      err = "unknown command";
+    }
+    if (err) {
+      fprintf(stderr, "%s:%d: %s: %s\n", script, lineno, cmd, err);
+      status = 1;
+    }
+  }
+  free(line);
+  fclose(fp);
+  if (status == 0 && !saved) {
+    int e = editorScriptSave("-");
+    if (e) {
+      fprintf(stderr, "kilo: can't write to stdout: %s\n", strerror(e));
+      status = 1;
+    }
+  }
+  return status;
+}
+
 /*** init ***/
 
 void initEditor(void) {
@@ -945,33 +4801,761 @@ void initEditor(void) {
   E.rowoff = 0; //scroll to the top of file by default
   E.coloff = 0;
   E.numrows = 0;
-  E.row = NULL;
+  E.rows.rows = NULL;
+  E.rows.cap = 0;
+  E.rows.gap = 0;
+  E.rows.gaplen = 0;
   E.dirty = 0;
+  E.edits = 0;
   E.filename = NULL;
+  E.map = NULL;
+  E.maplen = 0;
+  E.umask = umask(0); //there is no way to read it without setting it
+  umask(E.umask);
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
+  E.screen = NULL;
+  E.backscreen = NULL;
+  E.screenlines = 0;
+  E.screenvalid = 0;
+  E.frame.b = NULL;
+  E.frame.len = 0;
+  E.frame.cap = 0;
+  E.framebytes = 0;
+  E.find.query = NULL;
+  memset(&E.find.matches, 0, sizeof(E.find.matches));
+  E.find.job = NULL;
+  E.save = NULL;
+  memset(&E.undo, 0, sizeof(E.undo));
+  E.find.merged = 0;
+  E.syntax = NULL;
+  E.hlvalid = 0;
+  E.find.complete = 0;
+  E.find.current = -1;
+  E.find.regex = 0;
+  E.find.re = NULL;
+  E.find.locator = NULL;
+  E.find.threads = NULL;
+  E.find.nthreads = 0;
+  E.find.jobgen = 0;
+  E.input.head = 0;
+  E.input.tail = 0;
+  E.input.shead = 0;
+  E.input.stail = 0;
+  E.paste.b = NULL;
+  E.paste.len = 0;
+  E.paste.cap = 0;
+  E.follow.fd = -1;
+  E.follow.inotify = -1;
+  E.follow.wd = -1;
+  E.follow.dirwd = -1;
+  E.follow.stream = 0;
+  E.follow.armed = 0;
+  editorInitEvents();
+  editorInitKernels();
+  searchInitKernels();
+  editorSyntaxClasses();
+  if (E.headless) return; //the caller set the screen size, rows are highlighted in the foreground
+  editorSyntaxStartWorker();
+  atexit(editorLatencyDump);
 
   if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
   E.screenrows -= 2; //make space in final line for status bar, with this editorDrawRows() will not draw line at bottom of screen
 }
 
+//an editor without a terminal, rows x cols in size. keys are fed with E.feed
+void initEditorHeadless(int rows, int cols) {
+  E.headless = 1;
+  initEditor();
+  E.capture.b = NULL;
+  E.capture.len = 0;
+  E.capture.cap = 0;
+  E.feed = NULL;
+  E.feedlen = 0;
+  E.screenrows = rows - 2; //status bar and message bar
+  E.screencols = cols;
+}
+
+#ifndef KILO_BENCH
 int main(int argc, char *argv[]) {
+  if (argc >= 3 && strcmp(argv[1], "--script") == 0) {
+    initEditorHeadless(24, 80); //never drawn
+    if (argc >= 4 && strcmp(argv[3], "-") == 0) editorStreamAll(STDIN_FILENO);
+    else if (argc >= 4 && editorOpenFile(argv[3]) == -1) {
+      //die() would put escape codes in the output
+      fprintf(stderr, "kilo: %s: %s\n", argv[3], strerror(errno));
+      return 1;
+    }
+    return editorScript(argv[2]);
+  }
+  //kilo - read the buffer from stdin, keys then come from the terminal itself
+  int pipefd = -1;
+  if (argc >= 2 && strcmp(argv[1], "-") == 0 && !isatty(STDIN_FILENO)) {
+    pipefd = dup(STDIN_FILENO);
+    int tty = open("/dev/tty", O_RDWR);
+    if (pipefd == -1 || tty == -1 || dup2(tty, STDIN_FILENO) == -1) die("/dev/tty");
+    close(tty);
+  }
   enableRawMode();
   initEditor();
   //only call editoropen() when argc != 1, so it can compile and run blank program correctly
-  if (argc >= 2) {
+  if (pipefd != -1) {
+    editorStream(pipefd);
+  } else if (argc >= 3 && (strcmp(argv[1], "-f") == 0 || strcmp(argv[1], "--follow") == 0)) {
+    editorFollow(argv[2]);
+  } else if (argc >= 2 && strcmp(argv[1], "-") != 0) {
     editorOpen(argv[1]);
   }
  
   editorSetStatusMessage(
-    "HELP: Ctrl-Q = quit | Ctrl-Q = quit | Ctrl-F = find");
+    "HELP: Ctrl-S save | Ctrl-Q quit | Ctrl-F/R find/regex | Ctrl-Z/Y undo/redo"); //fit in statusmsg
 
   //it read 1 byte from standard input the into variable c and compare to 1(which is 1 byte of char)
   while (1) {
+    editorSavePoll();
+    editorFollowCheck();
     editorRefreshScreen();
     editorProcessKeypress();
   }
   return 0;
 }
 
-//currently on step 157. Lastest feature implement : syntax highlight .working on detect filetype
+#endif
+
+/*** bench ***/
+
+//build with `make bench`. kilo-bench runs editor code without a terminal and print timings.
+//`make bench-keys` run keystroke scripts through the whole editor instead (see benchKeys())
+//`make regex-check` compare the regex engine with regcomp() on random patterns
+#ifdef KILO_BENCH
+
+enum benchCorpusKind {
+  CORPUS_LOG, //short lines of words, numbers and some tabs
+  CORPUS_LONG, //lines of about a megabyte, like minified files
+  CORPUS_TABS, //indented code, mostly tabs
+  CORPUS_TOKENS //long runs of word chars: session tokens, base64 and hashes in a log
+};
+
+//write a corpus to a temporary file, return its name (free it and unlink the file)
+char *benchCorpus(int kind, int lines) {
+  char *path = strdup("/tmp/kilo-bench-XXXXXX");
+  int fd = mkstemp(path);
+  if (fd == -1) die("mkstemp");
+  FILE *fp = fdopen(fd, "w");
+  static const char *words[] = {"error", "warn", "info", "request", "id=42", "user",
+    "timeout", "(ptr)", "0x1f", "3.14", "latency_ms", "\t", "done", "retry", "GET", "/api/v1"};
+  unsigned seed = 12345;
+  int j, w;
+  for (j = 0; j < lines; j++) {
+    int nwords = kind == CORPUS_LONG ? 150000 : 8;
+    if (kind == CORPUS_TABS) {
+      seed = seed * 1103515245 + 12345;
+      for (w = (seed >> 16) % 6; w >= 0; w--) fputc('\t', fp);
+      fprintf(fp, "if (x%d == 42) {\t/* %d */", j % 97, j);
+      nwords = 3;
+    } else if (kind == CORPUS_TOKENS) {
+      static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_";
+      fprintf(fp, "%d session", j);
+      for (w = 0; w < 4; w++) {
+        seed = seed * 1103515245 + 12345;
+        int n = 40 + (seed >> 16) % 160, k;
+        fputs(w ? " t" : "=k", fp); //start with a letter, not a number
+        for (k = 0; k < n; k++) {
+          seed = seed * 1103515245 + 12345;
+          fputc(b64[(seed >> 16) % 63], fp);
+        }
+      }
+      nwords = 2;
+    } else {
+      fprintf(fp, "%d", j);
+    }
+    for (w = 0; w < nwords; w++) {
+      seed = seed * 1103515245 + 12345;
+      fprintf(fp, "%s%s", kind == CORPUS_TABS ? "\t" : " ", words[(seed >> 16) % 16]);
+    }
+    fputc('\n', fp);
+  }
+  fclose(fp);
+  return path;
+}
+
+//old Ctrl-F inner loop: strstr() on every rendered row
+int benchStrstr(const char *query) {
+  int hits = 0;
+  int j;
+  for (j = 0; j < E.numrows; j++)
+    if (strstr(editorRowAt(j)->render, query)) hits++;
+  return hits;
+}
+
+int benchSearchEngine(const char *query) {
+  editorSearchReset();
+  editorSearchUpdate(query);
+  editorSearchWait(-1);
+  return E.find.matches.len;
+}
+
+//time fn(query) a few times and print the best throughput over bytes
+void benchReport(const char *name, const char *query, int (*fn)(const char *), double bytes) {
+  double best = 1e9;
+  int hits = 0;
+  int run;
+  for (run = 0; run < 5; run++) {
+    double t = editorNow();
+    hits = fn(query);
+    t = editorNow() - t;
+    if (t < best) best = t;
+  }
+  printf("%-22s %-16s %8d rows %9.2f ms %9.1f MB/s\n", name, query, hits, best * 1e3, bytes / best / 1e6);
+}
+
+//render and highlight every row from scratch, the work done the first time a row is drawn
+int benchRenderRows(const char *unused) {
+  (void)unused;
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    row->flags &= ~(ROW_RENDERED | ROW_TABS); //render and the tab index are rebuilt in place
+    row->hl_start = HL_STATE_UNKNOWN;
+  }
+  E.hlvalid = 0;
+  for (j = 0; j < E.numrows; j++) editorRowPrepare(j);
+  return E.numrows;
+}
+
+//highlight every row again, render is already built. the part the word kernels speed up
+int benchSyntaxRows(const char *unused) {
+  (void)unused;
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    row->hl_start = 0;
+    editorUpdateSyntax(row);
+  }
+  return E.numrows;
+}
+
+//the highlighter as it was before the char class table and the word kernels: isdigit() and a
+//strchr() per char, one char per step. kept as the baseline the highlight bench is measured against
+int benchIsSeparatorBaseline(int c) {
+  return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+void benchSyntaxScanBaseline(const char *s, int len, unsigned char *hl, struct hlState *st) {
+  struct editorSyntax *syntax = E.syntax;
+  int flags = syntax ? syntax->flags : HL_HIGHLIGHT_NUMBERS;
+  char **keywords = syntax ? syntax->keywords : NULL;
+  char *scs = syntax ? syntax->singleline_comment_start : NULL;
+  char *mcs = syntax ? syntax->multiline_comment_start : NULL;
+  char *mce = syntax ? syntax->multiline_comment_end : NULL;
+  int scs_len = scs ? strlen(scs) : 0;
+  int mcs_len = mcs ? strlen(mcs) : 0;
+  int mce_len = mce ? strlen(mce) : 0;
+  int i = 0;
+
+  while (i < len) {
+    char c = s[i];
+    if (!st->in_string && !st->in_comment && editorSyntaxAt(s, len, i, scs, scs_len)) {
+      memset(&hl[i], HL_COMMENT, len - i);
+      return;
+    }
+    if (mcs_len && mce_len && !st->in_string) {
+      if (st->in_comment) {
+        if (editorSyntaxAt(s, len, i, mce, mce_len)) {
+          memset(&hl[i], HL_MLCOMMENT, mce_len);
+          i += mce_len;
+          st->in_comment = 0;
+          st->prev_sep = 1;
+        } else {
+          hl[i++] = HL_MLCOMMENT;
+        }
+        st->prev_hl = HL_MLCOMMENT;
+        continue;
+      } else if (editorSyntaxAt(s, len, i, mcs, mcs_len)) {
+        memset(&hl[i], HL_MLCOMMENT, mcs_len);
+        i += mcs_len;
+        st->in_comment = 1;
+        st->prev_hl = HL_MLCOMMENT;
+        continue;
+      }
+    }
+    if (flags & HL_HIGHLIGHT_STRINGS) {
+      if (st->in_string) {
+        hl[i] = HL_STRING;
+        st->prev_hl = HL_STRING;
+        st->prev_sep = 1;
+        if (c == '\\' && i + 1 < len) {
+          hl[i + 1] = HL_STRING;
+          i += 2;
+          continue;
+        }
+        if (c == st->in_string) st->in_string = 0;
+        i++;
+        continue;
+      } else if (c == '"' || c == '\'') {
+        st->in_string = c;
+        hl[i++] = HL_STRING;
+        st->prev_hl = HL_STRING;
+        continue;
+      }
+    }
+    if (keywords && st->prev_sep) {
+      int j;
+      for (j = 0; keywords[j]; j++) {
+        int klen = strlen(keywords[j]);
+        int kw2 = keywords[j][klen - 1] == '|';
+        if (kw2) klen--;
+        if (editorSyntaxAt(s, len, i, keywords[j], klen) &&
+            (i + klen == len || benchIsSeparatorBaseline(s[i + klen]))) {
+          unsigned char h = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+          memset(&hl[i], h, klen);
+          i += klen;
+          st->prev_hl = h;
+          st->prev_sep = 0;
+          break;
+        }
+      }
+      if (keywords[j]) continue;
+    }
+    unsigned char h = HL_NORMAL;
+    if ((flags & HL_HIGHLIGHT_NUMBERS) &&
+        ((isdigit(c) && (st->prev_sep || st->prev_hl == HL_NUMBER)) ||
+         (c == '.' && st->prev_hl == HL_NUMBER))) {
+      h = HL_NUMBER;
+      st->prev_sep = 0;
+    } else {
+      st->prev_sep = benchIsSeparatorBaseline(c);
+    }
+    hl[i++] = h;
+    st->prev_hl = h;
+  }
+}
+
+int benchSyntaxRowsBaseline(const char *unused) {
+  (void)unused;
+  int j;
+  for (j = 0; j < E.numrows; j++) {
+    erow *row = editorRowAt(j);
+    struct hlState st = {0, 0, 1, HL_NORMAL};
+    benchSyntaxScanBaseline(row->render, row->rsize, row->hl, &st);
+    row->hl_open = st.in_comment;
+  }
+  return E.numrows;
+}
+
+void benchLoad(char *path) {
+  double t = editorNow();
+  editorOpen(path);
+  t = editorNow() - t;
+  double bytes = 0;
+  int j;
+  for (j = 0; j < E.numrows; j++) bytes += editorRowAt(j)->size + 1;
+  printf("load: %d rows, %.1f MB in %.2f ms, %.1f MB/s\n", E.numrows, bytes / 1e6, t * 1e3,
+    bytes / t / 1e6);
+}
+
+//throughput of render + highlight with each word kernel the CPU can run, without a filetype
+//and as C. "hl only (baseline)" is the highlighter before the table, what the others are compared to
+void benchHighlight(void) {
+  struct editorSyntax *syntax = E.syntax;
+  int (*kernel)(const char *, int, int) = hlSkipWordKernel;
+  int (*kernels[2])(const char *, int, int) = {hlSkipWordScalar};
+  int nkernels = 1;
+#ifdef __SSE2__
+  kernels[nkernels++] = hlSkipWordSSE2;
+#endif
+  double bytes = 0;
+  int j, k, ft;
+  for (j = 0; j < E.numrows; j++) bytes += editorRowAt(j)->size + 1;
+  for (ft = 0; ft < 2; ft++) {
+    E.syntax = ft ? &HLDB[0] : NULL;
+    editorSyntaxClasses();
+    benchRenderRows(NULL); //render and hl allocated for the baseline
+    benchReport("hl only (baseline)", ft ? E.syntax->filetype : "no filetype", benchSyntaxRowsBaseline, bytes);
+    for (k = 0; k < nkernels; k++) {
+      hlSkipWordKernel = kernels[k];
+      editorSyntaxClasses();
+      char name[32];
+      snprintf(name, sizeof(name), "highlight (%s)", editorKernelName());
+      benchReport(name, ft ? E.syntax->filetype : "no filetype", benchRenderRows, bytes);
+      snprintf(name, sizeof(name), "hl only (%s)", editorKernelName());
+      benchReport(name, ft ? E.syntax->filetype : "no filetype", benchSyntaxRows, bytes);
+    }
+  }
+  hlSkipWordKernel = kernel;
+  E.syntax = syntax;
+  editorSyntaxClasses();
+  editorSyntaxReset();
+}
+
+void benchSearch(void) {
+  static const char *queries[] = {"latency_ms retry", "id=42 user", "not-in-the-file", "99999 "};
+  double bytes = 0;
+  int j, q;
+  for (j = 0; j < E.numrows; j++) {
+    editorRowPrepare(j); //strstr needs render, the engine doesn't
+    bytes += editorRowAt(j)->size + 1;
+  }
+  printf("search: %d rows, %.1f MB\n", E.numrows, bytes / 1e6);
+  //every kernel the CPU can run, the one searchInitKernels() picked last
+  const char *(*kernel)(const struct searchPattern *, const char *, size_t) = searchKernel;
+  const char *(*kernels[3])(const struct searchPattern *, const char *, size_t) = {searchKernelHorspool};
+  int nkernels = 1, k;
+#ifdef __SSE2__
+  if (kernel != searchKernelSSE2) kernels[nkernels++] = searchKernelSSE2;
+#endif
+  if (kernel != searchKernelHorspool) kernels[nkernels++] = kernel;
+  for (q = 0; q < 4; q++) {
+    benchReport("strstr loop", queries[q], benchStrstr, bytes);
+    for (k = 0; k < nkernels; k++) {
+      char name[32];
+      searchKernel = kernels[k];
+      snprintf(name, sizeof(name), "engine (%s)", searchKernelName());
+      benchReport(name, queries[q], benchSearchEngine, bytes);
+    }
+  }
+  searchKernel = kernel;
+
+  //typing the query one key at a time, like Ctrl-F does
+  const char *typed = "latency_ms retry";
+  char prefix[32];
+  int hits = 0;
+  double t_old = editorNow();
+  for (j = 1; j <= (int)strlen(typed); j++) {
+    snprintf(prefix, sizeof(prefix), "%.*s", j, typed);
+    hits += benchStrstr(prefix);
+  }
+  t_old = editorNow() - t_old;
+  double t_new = editorNow();
+  editorSearchReset();
+  for (j = 1; j <= (int)strlen(typed); j++) {
+    snprintf(prefix, sizeof(prefix), "%.*s", j, typed);
+    editorSearchUpdate(prefix);
+    editorSearchWait(-1);
+  }
+  t_new = editorNow() - t_new;
+  printf("typing \"%s\": strstr loop %.2f ms (%d hits), engine with narrowing %.2f ms\n",
+    typed, t_old * 1e3, hits, t_new * 1e3);
+
+  editorDetachMap(); //same rows copied to the heap, no contiguous runs anymore
+  for (q = 0; q < 4; q++)
+    benchReport("engine (heap rows)", queries[q], benchSearchEngine, bytes);
+}
+
+//keystrokes of one scenario, split in ops that are timed one by one. an op is one key, or a
+//whole prompt (Ctrl-F, the query and Enter)
+struct benchScript {
+  struct abuf keys; //every op back to back
+  int *ends; //op k is keys.b[ends[k - 1], ends[k])
+  int n;
+  int cap;
+};
+
+void benchOp(struct benchScript *sc, const char *keys, int len) {
+  if (sc->n == sc->cap) {
+    sc->cap = sc->cap ? sc->cap * 2 : 256;
+    sc->ends = realloc(sc->ends, sizeof(int) * sc->cap);
+  }
+  abAppend(&sc->keys, keys, len);
+  sc->ends[sc->n++] = sc->keys.len;
+}
+
+//the same key times times
+void benchOps(struct benchScript *sc, const char *keys, int times) {
+  while (times-- > 0) benchOp(sc, keys, strlen(keys));
+}
+
+//Ctrl-G to row at (0 based), as one op
+void benchGoto(struct benchScript *sc, int at) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x07%d\r", at + 1);
+  benchOp(sc, buf, len);
+}
+
+void benchFreeScript(struct benchScript *sc) {
+  abFree(&sc->keys);
+  free(sc->ends);
+  memset(sc, 0, sizeof(*sc));
+}
+
+//feed every op to the headless editor like the main loop would: keys, then a refresh.
+//lat (if not NULL) get the time of each op, edit and draw add up the two halves
+void benchRun(struct benchScript *sc, double *lat, double *edit, double *draw, long long *bytes) {
+  int k, start = 0;
+  for (k = 0; k < sc->n; k++) {
+    E.feed = sc->keys.b + start;
+    E.feedlen = sc->ends[k] - start;
+    start = sc->ends[k];
+    double t0 = editorNow();
+    while (E.feedlen > 0 || E.input.head != E.input.tail) editorProcessKeypress();
+    double t1 = editorNow();
+    editorRefreshScreen();
+    double t2 = editorNow();
+    if (lat) {
+      lat[k] = t2 - t0;
+      *edit += t1 - t0;
+      *draw += t2 - t1;
+      *bytes += E.capture.len;
+    }
+    abReset(&E.capture);
+  }
+}
+
+int benchCompareDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+//scenarios get the open corpus, setup ops aren't timed
+void benchScenarioType(struct benchScript *setup, struct benchScript *ops) {
+  benchGoto(setup, E.numrows / 2);
+  int j;
+  for (j = 0; j < 2000; j++) {
+    char c = j % 50 == 49 ? '\r' : 'a' + j % 26;
+    benchOp(ops, &c, 1);
+  }
+}
+
+void benchScenarioDelete(struct benchScript *setup, struct benchScript *ops) {
+  benchGoto(setup, E.numrows / 2);
+  benchOps(setup, "\x1b[F", 1); //End
+  benchOps(ops, "\x7f", 1000);
+}
+
+void benchScenarioScroll(struct benchScript *setup, struct benchScript *ops) {
+  (void)setup;
+  benchOps(ops, "\x1b[6~", 200); //Page Down
+  benchOps(ops, "\x1b[B", 200);
+  benchOps(ops, "\x1b[5~", 200); //Page Up
+}
+
+void benchScenarioGoto(struct benchScript *setup, struct benchScript *ops) {
+  (void)setup;
+  unsigned seed = 7;
+  int j;
+  for (j = 0; j < 100; j++) {
+    seed = seed * 1103515245 + 12345;
+    benchGoto(ops, (seed >> 8) % E.numrows);
+  }
+}
+
+void benchScenarioCursor(struct benchScript *setup, struct benchScript *ops) {
+  benchGoto(setup, E.numrows / 2);
+  int j;
+  for (j = 0; j < 50; j++) {
+    benchOps(ops, "\x1b[C", 20);
+    benchOps(ops, "\x1b[F", 1); //End
+    benchOps(ops, "\x1b[B", 1);
+    benchOps(ops, "\x1b[H", 1); //Home
+  }
+}
+
+void benchScenarioUndo(struct benchScript *setup, struct benchScript *ops) {
+  benchGoto(setup, E.numrows / 2);
+  int j;
+  for (j = 0; j < 500; j++) benchOps(setup, j % 10 == 9 ? " " : "x", 1);
+  benchOps(ops, "\x1a", 200); //Ctrl-Z
+  benchOps(ops, "\x19", 200); //Ctrl-Y
+}
+
+void benchScenarioSearch(struct benchScript *setup, struct benchScript *ops) {
+  (void)setup;
+  static const char *queries[] = {"\x06retry GET\r", "\x06not-in-the-file\r", "\x06done\x1b[B\x1b[B\r"};
+  int j;
+  for (j = 0; j < 12; j++) benchOps(ops, queries[j % 3], 1);
+}
+
+void benchScenarioPaste(struct benchScript *setup, struct benchScript *ops) {
+  benchGoto(setup, E.numrows / 2);
+  struct abuf paste = ABUF_INIT;
+  abAppend(&paste, "\x1b[200~", 6);
+  const char *line = "{\"id\": 42, \"tags\": [\"a\", \"b\"]}\r";
+  while (paste.len < 64 * 1024) abAppend(&paste, line, strlen(line));
+  abAppend(&paste, "\x1b[201~", 6);
+  int j;
+  for (j = 0; j < 5; j++) benchOp(ops, paste.b, paste.len);
+  abFree(&paste);
+}
+
+struct benchScenario {
+  const char *name;
+  void (*build)(struct benchScript *setup, struct benchScript *ops);
+};
+
+//run every scenario on a fresh copy of each corpus, print latency percentiles per op and
+//append one JSON object per line to json (if not NULL) so results can be tracked over time
+void benchKeys(const char *json) {
+  static const struct benchScenario scenarios[] = {
+    {"type", benchScenarioType}, {"delete", benchScenarioDelete}, {"scroll", benchScenarioScroll},
+    {"goto", benchScenarioGoto}, {"cursor", benchScenarioCursor}, {"undo", benchScenarioUndo},
+    {"search", benchScenarioSearch}, {"paste", benchScenarioPaste},
+  };
+  static const struct { const char *name; int kind; int lines; } corpora[] = {
+    {"huge", CORPUS_LOG, 1000000}, {"long", CORPUS_LONG, 8}, {"tabs", CORPUS_TABS, 200000},
+  };
+  FILE *out = json ? fopen(json, "w") : NULL;
+  if (json && out == NULL) die("fopen");
+  E.screenrows = 60 - 2;
+  E.screencols = 200;
+  printf("keys: %dx%d headless screen, latency of one op (keys + refresh)\n", E.screenrows + 2, E.screencols);
+  printf("%-6s %-8s %6s %9s %9s %9s %9s %9s %9s %10s\n", "corpus", "scenario", "ops",
+    "p50 us", "p90 us", "p99 us", "max us", "edit us", "draw us", "bytes/op");
+  unsigned c, k;
+  for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+    char *path = benchCorpus(corpora[c].kind, corpora[c].lines);
+    for (k = 0; k < sizeof(scenarios) / sizeof(scenarios[0]); k++) {
+      editorOpen(path);
+      E.cx = E.cy = E.rowoff = E.coloff = 0;
+      editorInvalidateScreen();
+      struct benchScript setup = {ABUF_INIT, NULL, 0, 0}, ops = {ABUF_INIT, NULL, 0, 0};
+      scenarios[k].build(&setup, &ops);
+      benchRun(&setup, NULL, NULL, NULL, NULL);
+      editorRefreshScreen();
+      abReset(&E.capture);
+
+      double *lat = malloc(sizeof(double) * ops.n);
+      double edit = 0, draw = 0;
+      long long bytes = 0;
+      benchRun(&ops, lat, &edit, &draw, &bytes);
+      qsort(lat, ops.n, sizeof(double), benchCompareDouble);
+      int n = ops.n;
+      double p50 = lat[n / 2] * 1e6, p90 = lat[n * 9 / 10] * 1e6, p99 = lat[n * 99 / 100] * 1e6;
+      double max = lat[n - 1] * 1e6;
+      printf("%-6s %-8s %6d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10.0f\n", corpora[c].name,
+        scenarios[k].name, n, p50, p90, p99, max, edit / n * 1e6, draw / n * 1e6, (double)bytes / n);
+      if (out)
+        fprintf(out, "{\"corpus\":\"%s\",\"scenario\":\"%s\",\"ops\":%d,\"screen\":\"%dx%d\","
+          "\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+          "\"edit_us\":%.1f,\"draw_us\":%.1f,\"bytes_per_op\":%.0f,\"time\":%ld}\n",
+          corpora[c].name, scenarios[k].name, n, E.screenrows + 2, E.screencols,
+          p50, p90, p99, max, edit / n * 1e6, draw / n * 1e6, (double)bytes / n, (long)time(NULL));
+      free(lat);
+      benchFreeScript(&setup);
+      benchFreeScript(&ops);
+      E.dirty = 0;
+    }
+    unlink(path);
+    free(path);
+  }
+  if (out) fclose(out);
+}
+
+//kilo-bench [file]: load, highlight and search benchmarks, on file or a generated log
+//kilo-bench --keys [--json out]: keystroke latency through the whole editor
+//append a random regex to p, only the syntax POSIX ERE and our engine read the same way:
+//no \d \w \s, no empty branch or group and nothing repeated twice or applied to ^ $.
+//glibc get ^ and $ inside a repeated group wrong ((a?^b)+), so anchors only go elsewhere
+void benchRandomRegex(struct abuf *p, int depth, int repeated) {
+  static const char *atoms[] = {"a", "b", "1", ".", "[ab]", "[^a]", "[a-b1]", " "};
+  int n = 1 + rand() % 3, j;
+  for (j = 0; j < n; j++) {
+    int r = rand() % 10;
+    if (r < 2 && !repeated) {
+      abAppend(p, r == 0 ? "^" : "$", 1);
+      continue;
+    }
+    int op = rand() % 8; //0-2 repeat with * + ?
+    if (r == 2 && depth < 2) {
+      abAppend(p, "(", 1);
+      benchRandomRegex(p, depth + 1, repeated || op < 3);
+      abAppend(p, ")", 1);
+    } else {
+      const char *a = atoms[rand() % (sizeof(atoms) / sizeof(atoms[0]))];
+      abAppend(p, a, strlen(a));
+    }
+    if (op < 3) abAppend(p, &"*+?"[op], 1);
+  }
+  if (depth < 2 && rand() % 3 == 0) {
+    abAppend(p, "|", 1);
+    benchRandomRegex(p, depth + 1, repeated);
+  }
+}
+
+//compare the regex engine against regcomp()/regexec() on random patterns and rows: whether a
+//row match, and where the leftmost-longest match start and end. return the number of mismatches
+int benchRegexCheck(int cases) {
+  static const char alphabet[] = "ab1 ";
+  static const char *fixed[] = {"1|a$", "^b|a", "a$|^b", "(^a|b)1", "a(b$|1)", "^$", "^|a", "$a|b"};
+  int nfixed = sizeof(fixed) / sizeof(fixed[0]);
+  struct abuf pat = ABUF_INIT;
+  int bad = 0, checked = 0, c;
+  srand(1);
+  for (c = 0; c < nfixed + cases; c++) {
+    abReset(&pat);
+    if (c < nfixed) abAppend(&pat, fixed[c], strlen(fixed[c]));
+    else benchRandomRegex(&pat, 0, 0);
+    abAppend(&pat, "", 1); //nul
+    regex_t posix;
+    struct regex *re = regexCompile(pat.b);
+    if (regcomp(&posix, pat.b, REG_EXTENDED) != 0) {
+      regexFree(re);
+      continue;
+    }
+    if (re == NULL) {
+      if (bad++ < 10) printf("mismatch: /%s/ refused, regcomp took it\n", pat.b);
+      regfree(&posix);
+      continue;
+    }
+    struct dfa d;
+    dfaInit(&d, &re->fwd, 1);
+    struct regexLocator *rl = regexLocatorNew(re);
+    int k;
+    for (k = 0; k < (c < nfixed ? 500 : 20); k++) {
+      char text[16];
+      int len = rand() % (sizeof(text) - 1), j;
+      for (j = 0; j < len; j++) text[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+      text[len] = '\0';
+      regmatch_t m;
+      int want = regexec(&posix, text, 1, &m, 0) == 0;
+      int got = regexMatchRow(re, &d, text, len);
+      int start = -1, end = -1;
+      int located = regexLocate(re, rl, text, len, &start, &end);
+      if (got != want || located != want || (want && (start != m.rm_so || end != m.rm_eo))) {
+        if (bad++ < 10)
+          printf("mismatch: /%s/ on \"%s\": regexec %d [%d,%d), kilo %d/%d [%d,%d)\n", pat.b, text,
+            want, want ? (int)m.rm_so : -1, want ? (int)m.rm_eo : -1, got, located, start, end);
+      }
+      checked++;
+    }
+    regexLocatorFree(rl);
+    dfaFree(&d);
+    regexFree(re);
+    regfree(&posix);
+  }
+  abFree(&pat);
+  printf("regex check: %d rows against regexec(), %d mismatches\n", checked, bad);
+  return bad;
+}
+
+int main(int argc, char *argv[]) {
+  initEditorHeadless(24, 80);
+  if (argc >= 2 && strcmp(argv[1], "--regex-check") == 0) {
+    return benchRegexCheck(argc >= 3 ? atoi(argv[2]) : 20000) ? 1 : 0;
+  }
+  if (argc >= 2 && strcmp(argv[1], "--keys") == 0) {
+    benchKeys(argc >= 4 && strcmp(argv[2], "--json") == 0 ? argv[3] : NULL);
+    return 0;
+  }
+  char *corpus = NULL;
+  if (argc >= 2) {
+    benchLoad(argv[1]);
+  } else {
+    corpus = benchCorpus(CORPUS_LOG, 1000000);
+    benchLoad(corpus);
+  }
+  benchHighlight();
+  benchSearch();
+  if (corpus) {
+    unlink(corpus);
+    free(corpus);
+    //where the word kernels pay off: words long enough to be skipped a vector at a time
+    corpus = benchCorpus(CORPUS_TOKENS, 200000);
+    benchLoad(corpus);
+    benchHighlight();
+    unlink(corpus);
+    free(corpus);
+  }
+  return 0;
+}
+
+#endif